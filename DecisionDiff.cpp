@@ -0,0 +1,66 @@
+//
+//  DecisionDiff.cpp
+//  CloudSim
+//
+//  Reports the first divergence between two decision logs: ./decision_diff before.log after.log
+//
+
+#include <cstring>
+#include <iostream>
+
+#include "DecisionLog.h"
+
+using namespace std;
+
+#define DIFF_CONTEXT 5 // Records shown before the divergence
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        cerr << "Usage: " << argv[0] << " <log> <log>" << endl;
+        return 2;
+    }
+    vector<DecisionRecord> logs[2];
+    for (int i = 0; i < 2; i++)
+    {
+        if (!ReadDecisionLog(argv[i + 1], logs[i]))
+        {
+            cerr << argv[i + 1] << " is not a decision log" << endl;
+            return 2;
+        }
+    }
+
+    size_t common = min(logs[0].size(), logs[1].size());
+    size_t first = 0;
+    while (first < common && memcmp(&logs[0][first], &logs[1][first], sizeof(DecisionRecord)) == 0)
+    {
+        first++;
+    }
+    if (first == logs[0].size() && first == logs[1].size())
+    {
+        cout << "Logs are identical, " << first << " records" << endl;
+        return 0;
+    }
+
+    // Name the callback the divergence happened in
+    size_t callback = first;
+    while (callback > 0 && logs[0][callback - 1].kind >= DL_FIRST_ACTION)
+    {
+        callback--;
+    }
+    cout << "Logs diverge at record " << first;
+    if (callback > 0)
+        cout << ", while handling " << DecisionToString(logs[0][callback - 1]);
+    cout << endl;
+    for (size_t i = first > DIFF_CONTEXT ? first - DIFF_CONTEXT : 0; i < first; i++)
+    {
+        cout << "  " << i << ": " << DecisionToString(logs[0][i]) << endl;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        cout << (i == 0 ? "< " : "> ") << first << ": "
+             << (first < logs[i].size() ? DecisionToString(logs[i][first]) : "end of log") << endl;
+    }
+    return 1;
+}
@@ -0,0 +1,88 @@
+//
+//  DecisionLog.h
+//  CloudSim
+//
+//  Binary log of the scheduler's callbacks and actions, shared by the scheduler (record/replay) and decision_diff.
+//
+
+#ifndef DecisionLog_h
+#define DecisionLog_h
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// A log is DECISION_LOG_MAGIC, DECISION_LOG_VERSION, then fixed-size records in the order they happened. Each
+// callback record is followed by the actions the scheduler took while handling it.
+#define DECISION_LOG_MAGIC 0x4c445343u // "CSDL"
+#define DECISION_LOG_VERSION 1u
+
+enum DecisionKind : uint32_t
+{
+    // Callbacks, with their time and argument
+    DL_INIT,
+    DL_NEW_TASK,              // task
+    DL_TASK_COMPLETE,         // task
+    DL_PERIODIC_CHECK,        //
+    DL_STATE_CHANGE_COMPLETE, // machine
+    DL_MIGRATION_DONE,        // vm
+    DL_MEMORY_WARNING,        // machine
+    DL_SLA_WARNING,           // task
+    DL_SIMULATION_COMPLETE,   //
+    // Actions
+    DL_FIRST_ACTION,
+    DL_VM_CREATE = DL_FIRST_ACTION, // vm, vm type, cpu
+    DL_VM_ATTACH,                   // vm, machine
+    DL_VM_ADD_TASK,                 // vm, task, priority
+    DL_VM_REMOVE_TASK,              // vm, task
+    DL_VM_MIGRATE,                  // vm, target machine
+    DL_VM_SHUTDOWN,                 // vm
+    DL_MACHINE_SET_STATE,           // machine, S-state
+    DL_SET_TASK_PRIORITY,           // task, priority
+    DL_SET_CORE_PERFORMANCE,        // machine, core, P-state
+    DL_KINDS
+};
+
+struct DecisionRecord
+{
+    uint64_t time;
+    uint32_t kind;
+    uint32_t args[3];
+};
+static_assert(sizeof(DecisionRecord) == 24, "DecisionRecord is written to disk as is");
+
+inline const char *DecisionKindName(uint32_t kind)
+{
+    static const char *names[DL_KINDS] = {"Init", "NewTask", "TaskComplete", "PeriodicCheck", "StateChangeComplete",
+                                          "MigrationDone", "MemoryWarning", "SLAWarning", "SimulationComplete",
+                                          "VM_Create", "VM_Attach", "VM_AddTask", "VM_RemoveTask", "VM_Migrate",
+                                          "VM_Shutdown", "Machine_SetState", "SetTaskPriority",
+                                          "Machine_SetCorePerformance"};
+    return kind < DL_KINDS ? names[kind] : "Unknown";
+}
+
+inline std::string DecisionToString(const DecisionRecord &record)
+{
+    return std::string(DecisionKindName(record.kind)) + "(" + std::to_string(record.args[0]) + ", " +
+           std::to_string(record.args[1]) + ", " + std::to_string(record.args[2]) + ") at " + std::to_string(record.time);
+}
+
+// Reads a whole log. Returns false when the file cannot be opened or does not start with the expected header.
+inline bool ReadDecisionLog(const std::string &path, std::vector<DecisionRecord> &records)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+    uint32_t header[2] = {0, 0};
+    bool valid = fread(header, sizeof(header), 1, file) == 1 && header[0] == DECISION_LOG_MAGIC && header[1] == DECISION_LOG_VERSION;
+    DecisionRecord record;
+    while (valid && fread(&record, sizeof(record), 1, file) == 1)
+    {
+        records.push_back(record);
+    }
+    fclose(file);
+    return valid;
+}
+
+#endif /* DecisionLog_h */
@@ -42,6 +42,7 @@ extern void             HandleTaskCompletion(Time_t time, TaskId_t task_id);// C
 extern void             MemoryWarning(Time_t time, MachineId_t machine_id); // Called to alert the scheduler of memory overcommitment
 extern void             MigrationDone(Time_t time, VMId_t vm_id);           // Called to alert the scheduler that the VM has been migrated successfully
 extern void             SchedulerCheck(Time_t time);                        // Called periodically. You may want to do some monitoring and adjustments
+extern void             SchedulerWakeup(Time_t time, uint64_t cookie);      // Called once a wakeup requested with Scheduler_RequestWakeup is due
 extern void             SimulationComplete(Time_t time);                    // Called at the end of the simulation
 extern void             SLAWarning(Time_t time, TaskId_t task_id);          // Called to alert the schedule of an SLA violation
 extern void             StateChangeComplete(Time_t time, MachineId_t machine_id);   // Called in response to an earlier request to change the state of a machine
@@ -51,6 +52,8 @@ extern double           GetSLAReport(SLAType_t sla);
 
 // Simulator Interface
 extern Time_t           Now();
+extern void             Scheduler_CancelWakeup(uint64_t cookie);                // Drops the pending wakeup of the cookie, if any
+extern void             Scheduler_RequestWakeup(Time_t when, uint64_t cookie);  // Calls SchedulerWakeup(when, cookie) at `when` or the first callback after it
 
 // Task Interface
 extern unsigned         GetNumTasks();
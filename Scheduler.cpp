@@ -8,14 +8,59 @@
 #include "Scheduler.hpp"
 #include "Interfaces.h"
 #include "SimTypes.h"
+#include "DecisionLog.h"
 #include <map>
 #include <set>
+#include <tuple>
 #include <cassert>
 #include <climits>
+#include <cmath>
+#include <cstring>
 #include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <future>
 #include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #define MAX_UTIL 1.0f
+#define MAX_MIGRATIONS_PER_PLAN 8       // Upper bound on the VM_Migrate calls issued by one consolidation plan
+#define ASYNC_CONSOLIDATION true        // Plan consolidation on a background thread and apply the plan at the next periodic check
+#define MIGRATION_BASE_LATENCY 10000    // Fixed cost of a migration in microseconds
+#define MACHINE_NIC_BANDWIDTH 125       // Per-machine NIC bandwidth shared by its migrations (MB/s, a 1 Gb/s link)
+#define MIGRATION_DIRTY_RATE 0.0f       // Fraction of the VM memory dirtied per pre-copy round, 0 disables the term
+#define MIGRATION_TIME_DEFAULT 30000000 // Assumed migration time in microseconds until one has completed
+#define MIGRATION_PRECOPY_ROUNDS 3      // Pre-copy rounds before the final stop-and-copy
+#define FORECAST_ALPHA 0.3              // EWMA weight of the latest check interval in the demand forecast
+#define WAKEUP_LATENCY_DEFAULT 100000   // Assumed S5 -> S0 latency in microseconds until one has been observed
+#define MAX_PREWAKE_PER_CHECK 4         // Upper bound on the machines woken ahead of demand by one periodic check
+#define IDLE_HISTORY_ALPHA 0.5f         // EWMA weight of the latest idle period in a machine's idle prediction
+#define IDLE_PREDICTION_DEFAULT 200000  // Idle period assumed for a machine without history, in microseconds
+#define GPU_SPEEDUP 20.0f               // Speedup the simulator gives a GPU-capable task on a machine with GPUs
+#define SLACK_BOOST_FRACTION 0.1f       // Boost a task to high priority when its slack falls below this share of its remaining runtime
+#define SLACK_DEMOTE_FRACTION 2.0f      // Demote an SLA0 task one level while its slack exceeds this share
+#define MEMORY_PRESSURE_THRESHOLD 1.0f  // Evacuate a machine whose projected memory exceeds this share of its capacity
+#define MAX_CORE_OCCUPANCY 2.0f         // Placement skips machines that would run more than this many tasks per core
+#define END_ALIGNMENT_WEIGHT 0.5f       // Weight of the gap between a task's expected end and its machine's drain time in placement scores
+#define END_ALIGNMENT_HORIZON 10000000  // End times this far apart or more count as fully unaligned (us)
+#define DEADLINE_ENERGY_PLACEMENT true  // Among machines estimated to meet a task's target, add the estimated energy to the fit score
+#define MAX_STEALS_PER_CHECK 4          // Upper bound on the tasks idle cores pull from the pending queue and overloaded peers per check
+#define STEAL_FROM_PEERS false          // Also migrate VMs off time-slicing machines to idle cores
+#define MAX_SWITCHES_PER_MACHINE 2      // Priority changes per machine and check under a deadline core scheduler, bounding preemptions
+#define PLACEMENT_BENCHMARK_ROUNDS 0    // When non-zero, time the scoring kernels this many times at the end of the run
+#define WARM_VMS_PER_TYPE 1             // Idle VMs kept per machine and VM type for the next placement
+#define WARM_VM_TTL 5000000             // Idle VMs older than this are shut down (us)
+#define ARRIVAL_BATCH_QUANTUM 0         // Arrivals within this window are sorted before placement (us), 0 places each on arrival
+#define CHECK_BACKOFF_MAX 8             // Quiet periodic checks stretch the check cadence up to this many simulator periods
+#define SCHEDULER_CHECK_PERIOD 0        // Periodic work runs at most this often (us) unless a warning asks sooner, 0 for every simulator check
+#define CLUSTER_POWER_CAP 0             // Watts the whole cluster may draw, 0 for no cap
+#define POWER_CAP_PATH ""               // Optional "<CPU type> <watts>" lines capping the machines of each CPU type, empty for none
+#define POWER_CAP_MAX_DEFERRAL 10000000 // SLA3 arrivals wait at most this long for power headroom (us)
+#define ENERGY_PRICE_PATH ""            // Optional "<time us> <price>" series of energy price or carbon intensity, empty for a flat price
+#define CHEAP_PRICE_QUANTILE 0.25f      // Prices at or below this quantile of the series make a cheap window
+#define SLA2_DEFERRAL_SLACK 0.0f        // SLA2 arrivals with more than this many runtimes of slack wait for cheap windows too, 0 for none
 
 enum Algorithm
 {
@@ -26,6 +71,35 @@ enum Algorithm
 }; // TODO: Placeholder - We need to research which algo we want to do
 const Algorithm CURRENT_ALGORITHM = GREEDY;
 
+enum PlacementScorer
+{
+    DOT_PRODUCT, // Aligns the task's demand with the machine's headroom
+    L2_NORM,     // Leaves the smallest headroom vector behind, a multi-resource best fit
+    DOMINANT_FIT, // Fills the machine's most used resource the furthest
+    MEMORY_FIT    // Leaves the least memory behind and ignores the other resources
+};
+const PlacementScorer CURRENT_SCORER = L2_NORM;
+
+enum CoreScheduler
+{
+    ROUND_ROBIN,       // Priority by SLA, fixed at placement; the simulator time-slices within each level
+    SLA_PRIORITY,      // Priority by SLA, boosted as slack runs out
+    EARLIEST_DEADLINE, // On each machine the earliest target completions run at high priority
+    LEAST_SLACK        // On each machine the least slack runs at high priority
+};
+const CoreScheduler CURRENT_CORE_SCHEDULER = EARLIEST_DEADLINE;
+static PlacementScorer active_scorer = CURRENT_SCORER; // DOMINANT_FIT while deferred work is packed
+
+enum DecisionLogMode
+{
+    LOG_OFF,
+    LOG_RECORD, // Write every callback and action to DECISION_LOG_PATH
+    LOG_REPLAY  // Re-issue the actions in DECISION_LOG_PATH instead of running the policy
+};
+const DecisionLogMode DECISION_LOG_MODE = LOG_OFF;
+#define DECISION_LOG_PATH "decisions.log"
+#define DECISION_LOG_BUFFER 4096 // Records buffered between writes
+
 // Free-standing function declarations
 void InitGreedy();
 void InitPMapper();
@@ -79,52 +153,2496 @@ struct PendingMigration
     MachineId_t source_machine;
     MachineId_t target_machine;
     unsigned memory_impact;
+    Time_t start;                // When VM_Migrate was issued
+    Time_t estimated_completion; // From the bandwidth model at the time the migration started
 };
 static std::vector<PendingMigration> pending_migrations;
+static unsigned completed_migrations = 0;
+static Time_t total_migration_time = 0;           // Observed, over completed migrations
+static Time_t total_estimated_migration_time = 0; // Predicted, over completed migrations
 static std::map<MachineId_t, int> pending_transition_count;
+static bool consolidation_requested = false;
+
+// Demand forecast
+// Arrival rate (tasks per microsecond) and memory per task, smoothed per (CPU, VM type) over the periodic checks.
+struct DemandForecast
+{
+    double rate;
+    double task_memory;
+    unsigned window_arrivals; // Arrivals since the last periodic check
+    uint64_t window_memory;
+};
+static map<pair<CPUType_t, VMType_t>, DemandForecast> demand_forecasts;
+static Time_t forecast_window_start = 0;
+static Time_t check_interval = 0;                     // Last observed gap between periodic checks
+struct WakeRequest
+{
+    Time_t requested;
+    MachineState_t from;
+};
+static map<MachineId_t, WakeRequest> wake_requests; // Machines waking up, when they were asked to and from which state
+
+// Sleep states
+// S-state power in watts, used when Machine_GetInfo() does not report the class table
+static const unsigned default_s_state_power[S_STATES] = {120, 100, 100, 80, 40, 10, 0};
+// Wake-up latency out of each S-state in microseconds, replaced by the observed latency once a machine has woken from it
+static const double default_wake_latency[S_STATES] = {0, 0, 1000, 5000, 20000, 50000, WAKEUP_LATENCY_DEFAULT};
+// Longest wake-up latency a machine may sit behind, by the strictest SLA it served in its last busy period
+static const double sla_wake_budget[] = {1000, 20000, 100000, 1e12};
+static double wake_latency[S_STATES];
+struct IdleHistory
+{
+    bool idle;
+    Time_t idle_since;
+    double predicted_idle;
+    SLAType_t role;
+};
+static vector<IdleHistory> idle_history;
+static vector<MachineState_t> requested_state; // Last S-state each machine was asked to enter
+static vector<bool> machine_wakeable;           // Asked to leave S0 or still changing state
+static map<pair<CPUType_t, bool>, unsigned> wakeable_count; // Machines flagged in machine_wakeable, by CPU type and GPUs
+
+// Frequency planning
+// Factor on the MIPS a task needs to meet its target completion, by SLA. Zero leaves best-effort tasks unconstrained.
+static const double sla_dvfs_headroom[NUM_SLAS] = {1.25, 1.1, 1.0, 0.0};
+
+// Slack-priority engine
+static map<TaskId_t, Priority_t> task_priority; // Priority each running task currently runs at
+static multimap<double, TaskId_t> task_slack;   // Running tasks by slack in microseconds, least first, as of the last check
+static set<TaskId_t> boosted_tasks;             // Tasks that were raised above their SLA priority at some point
+static unsigned priority_boosts = 0;
+static unsigned priority_demotions = 0;
+static unsigned sla_saves = 0; // Boosted tasks that still finished by their target completion
+static unsigned priority_switches = 0; // Priority changes made by the core scheduler
+
+// Machine class descriptors
+// Every machine of a class shares the same static tables (power states, MIPS, memory, cores), so they
+// are interned once at Init and each machine only keeps the id of its class.
+typedef unsigned MachineClassId_t;
+struct MachineClass
+{
+    MachineClassId_t class_id;
+    CPUType_t cpu;
+    bool gpus;
+    unsigned num_cpus;
+    unsigned memory_size;
+    vector<unsigned> performance; // MIPS at each P state
+    vector<unsigned> c_states;
+    vector<unsigned> p_states;
+    vector<unsigned> s_states;
+    vector<MachineId_t> members; // Machines of this class, in id order
+};
+static vector<MachineClass> machine_classes;      // Immutable after InitMachineClasses()
+static vector<MachineClassId_t> machine_class_of; // Indexed by MachineId_t
+
+// Cluster summaries
+// Two levels of aggregation over the machines of each class: class -> groups of SUMMARY_GROUP_SIZE machines -> machine.
+// Every node keeps the largest free memory and free core count found below it, the total free memory and how many
+// machines are in S0, so placement only descends into the classes and groups that can fit a request.
+#define SUMMARY_GROUP_SIZE 64
+struct ClusterSummary
+{
+    unsigned max_free_memory; // Only counts stable S0 machines
+    unsigned max_free_cores;  // Only counts stable S0 machines
+    unsigned active_machines; // Machines in S0
+    uint64_t free_memory;     // Total over stable S0 machines
+};
+static vector<ClusterSummary> machine_summaries;       // Leaves, indexed by MachineId_t
+static vector<vector<ClusterSummary>> group_summaries; // Indexed by MachineClassId_t, then group
+static vector<ClusterSummary> class_summaries;         // Indexed by MachineClassId_t
+static vector<unsigned> machine_class_slot;            // Position of a machine in the members of its class
+static void UpdateMachineSummary(MachineId_t machine_id);
+static void UpdateWakeable(MachineId_t machine_id);
+static void UpdateMachinePower(MachineId_t machine_id, const MachineInfo_t &info);
+static void InvalidateEstimate(MachineId_t machine_id);
+static bool CPUTypeRunning(CPUType_t cpu);
+static bool WakeFitsPowerCap(MachineId_t machine_id, bool type_running);
+static void RecordWakeRefused();
+
+// Machine columns
+// Struct-of-arrays copy of the machine state placement scoring reads, indexed by MachineId_t and refreshed together
+// with the summaries, so scoring a candidate never goes through Machine_GetInfo. The columns are padded to a whole
+// number of SCORE_BLOCK lanes with machines that are never stable, so the vector kernel needs no tail loop.
+#define SCORE_BLOCK 8 // Floats per AVX2 register
+struct MachineColumns
+{
+    vector<float> memory_size;
+    vector<float> memory_used;
+    vector<float> num_cpus;
+    vector<float> active_tasks;
+    vector<float> core_mips; // P0 MIPS of one core
+    vector<int32_t> cpu;
+    vector<int32_t> gpus;
+    vector<int32_t> stable;   // 1 in S0 with no transition pending
+    vector<float> drain_time; // Latest expected end among the machine's tasks in seconds, 0 without tasks
+};
+static MachineColumns machine_columns;
+static vector<float> placement_scores; // Output of the scoring kernels, parallel to the columns
+
+// Task end times
+// Expected end of every placed task, kept per machine so a machine's drain time is the last of them. Placement
+// prefers machines that drain close to the new task's end, so a machine's tasks finish together and it can sleep
+// without migrating the stragglers away.
+static map<TaskId_t, Time_t> task_end;
+static vector<multiset<Time_t>> machine_task_ends; // Indexed by MachineId_t
+static double machine_seconds = 0;                 // Time integral of the machines in S0
+static unsigned aligned_placements = 0;            // New VMs opened for end-time alignment
+static unsigned machines_on = 0;
+static Time_t machines_on_since = 0;
+
+// Machine deltas
+// Every change the scheduler makes or is told about ends in UpdateMachineSummary, which acts as the observer of
+// machine state: besides the summaries and columns it keeps the set of stable S0 machines without tasks, so the
+// periodic checks visit those instead of calling Machine_GetInfo on the whole cluster.
+static set<MachineId_t> idle_machines;
+static uint64_t machine_deltas = 0; // State changes observed
+
+// Check cadence
+// The simulator calls SchedulerCheck on a fixed period. While nothing runs and nothing changes between calls the
+// scheduler runs its periodic work on a cadence that doubles up to CHECK_BACKOFF_MAX periods, and drops back to every
+// period as soon as a task runs, a machine changes, work is waiting, or a warning asks for a faster cadence. Running
+// tasks keep every check because the core schedulers and the frequency planner only re-rank them there.
+static Time_t last_simulator_check = 0;
+static Time_t simulator_check_period = 0;
+static Time_t next_check_due = 0;
+static unsigned check_backoff = 1;
+static uint64_t deltas_at_last_check = 0;
+static uint64_t checks_run = 0;
+static uint64_t checks_skipped = 0;
+
+// Wakeup timers
+// Scheduler_RequestWakeup asks for SchedulerWakeup to be called with a cookie at a given time, so a policy can act
+// at the moment it needs to instead of polling the periodic check. The prebuilt simulator has no event for them, so
+// due timers fire at the start of the first callback at or after their time that may place work: every periodic check
+// (skipped or not), arrival, migration, state change and warning, in time then cookie order. A cookie has at most one
+// pending wakeup; requesting it again moves it.
+enum WakeupCookie : uint64_t
+{
+    WAKE_CHEAP_WINDOW = 1 // Release the tasks deferred to a cheap energy-price window
+};
+static set<pair<Time_t, uint64_t>> wakeup_queue;
+static map<uint64_t, Time_t> wakeup_time; // Pending wakeup of each cookie
+static uint64_t wakeups_fired = 0;
+static Time_t total_wakeup_lateness = 0;
+
+void Scheduler_CancelWakeup(uint64_t cookie)
+{
+    auto it = wakeup_time.find(cookie);
+    if (it == wakeup_time.end())
+        return;
+    wakeup_queue.erase({it->second, cookie});
+    wakeup_time.erase(it);
+}
+void Scheduler_RequestWakeup(Time_t when, uint64_t cookie)
+{
+    Scheduler_CancelWakeup(cookie);
+    wakeup_queue.emplace(when, cookie);
+    wakeup_time[cookie] = when;
+}
+static void ServiceWakeups(Time_t now)
+{
+    while (!wakeup_queue.empty() && wakeup_queue.begin()->first <= now)
+    {
+        auto [when, cookie] = *wakeup_queue.begin();
+        wakeup_queue.erase(wakeup_queue.begin());
+        wakeup_time.erase(cookie);
+        wakeups_fired++;
+        total_wakeup_lateness += now - when;
+        SchedulerWakeup(now, cookie);
+    }
+}
+
+// Scheduler-side view of the VMs and tasks placed so far
+static map<VMId_t, MachineId_t> vm_machine;
+
+// Warm VM pool
+// VMs left without tasks stay attached for up to WARM_VM_TTL so bursts reuse them instead of paying VM_Create and
+// VM_Shutdown again. Their overhead stays in the machine's memory_used, so projections and summaries account for it.
+struct WarmVM
+{
+    MachineId_t machine_id;
+    VMType_t vm_type;
+    Time_t idle_since;
+};
+static map<VMId_t, WarmVM> warm_vms;
+static unsigned warm_hits = 0;    // Tasks placed on a warm VM
+static unsigned warm_misses = 0;  // VMs created for a placement
+static unsigned warm_expired = 0; // Warm VMs shut down by the TTL or the per-type bound
+
+// Arrival sorting
+// With ARRIVAL_BATCH_QUANTUM set, HandleNewTask buffers arrivals and the first arrival or periodic check after the
+// window closes places them largest first. Sorting is all the batch changes: each of its tasks still goes through
+// NewTask and its own scan of the machine columns. Completions do not flush: placing a task while the simulator is
+// still retiring one on the same core trips its C-state bookkeeping. The delay each task spent in the buffer is
+// reported at the end of the run.
+static vector<pair<TaskId_t, Time_t>> arrival_buffer; // Task and arrival time, in arrival order
+static uint64_t batched_tasks = 0;
+static uint64_t batches_placed = 0;
+static Time_t total_batching_delay = 0;
+static Time_t max_batching_delay = 0;
+static map<TaskId_t, VMId_t> task_vm;
 
 // PMapper Static Variables
 std::map<std::pair<CPUType_t, bool>, std::vector<MachineId_t>> sorted_classes;
 
-// Helper functions
-static Priority_t determine_priority(TaskId_t task_id)
-{
-    SLAType_t sla = RequiredSLA(task_id);
-    switch (sla)
-    {
-    case SLA0:
-        return HIGH_PRIORITY;
-    case SLA1:
-        return MID_PRIORITY;
-    case SLA2:
-    case SLA3:
-        return LOW_PRIORITY;
-    default:
-        return LOW_PRIORITY;
+// Helper functions
+static Priority_t determine_priority(TaskId_t task_id)
+{
+    SLAType_t sla = RequiredSLA(task_id);
+    switch (sla)
+    {
+    case SLA0:
+        return HIGH_PRIORITY;
+    case SLA1:
+        return MID_PRIORITY;
+    case SLA2:
+    case SLA3:
+        return LOW_PRIORITY;
+    default:
+        return LOW_PRIORITY;
+    }
+}
+// A machine's idle period ends when it is woken or given a VM; the length feeds its idle prediction
+static void EndIdlePeriod(MachineId_t machine_id, Time_t now)
+{
+    if (machine_id >= idle_history.size())
+        return;
+    IdleHistory &history = idle_history[machine_id];
+    if (history.idle)
+    {
+        double observed = double(now - history.idle_since);
+        history.predicted_idle = IDLE_HISTORY_ALPHA * observed + (1 - IDLE_HISTORY_ALPHA) * history.predicted_idle;
+        history.idle = false;
+        history.role = SLA3;
+    }
+}
+// Decision log
+// Recording buffers fixed-size records and writes them in blocks, so it stays cheap enough to leave on. Replay skips
+// the policy: each callback consumes its own record, checks it against the simulator's, then re-issues the actions
+// recorded after it. VM ids are remapped in case the simulator hands out different ones.
+static FILE *decision_log = nullptr;
+static vector<DecisionRecord> decision_buffer;
+static vector<DecisionRecord> replay_records;
+static size_t replay_next = 0;
+static map<unsigned, VMId_t> replay_vms; // Recorded VM id -> VM id in this run
+static void FlushDecisionLog()
+{
+    if (decision_log == nullptr)
+        return;
+    fwrite(decision_buffer.data(), sizeof(DecisionRecord), decision_buffer.size(), decision_log);
+    fflush(decision_log);
+    decision_buffer.clear();
+}
+static void RecordDecision(DecisionKind kind, Time_t time, unsigned arg0 = 0, unsigned arg1 = 0, unsigned arg2 = 0)
+{
+    if (DECISION_LOG_MODE != LOG_RECORD)
+        return;
+    if (decision_log == nullptr)
+    {
+        decision_log = fopen(DECISION_LOG_PATH, "wb");
+        if (decision_log == nullptr)
+            ThrowException("RecordDecision(): Cannot open " + string(DECISION_LOG_PATH));
+        uint32_t header[2] = {DECISION_LOG_MAGIC, DECISION_LOG_VERSION};
+        fwrite(header, sizeof(header), 1, decision_log);
+        decision_buffer.reserve(DECISION_LOG_BUFFER);
+    }
+    decision_buffer.push_back(DecisionRecord{time, kind, {arg0, arg1, arg2}});
+    if (decision_buffer.size() >= DECISION_LOG_BUFFER)
+        FlushDecisionLog();
+}
+static void ReplayAction(const DecisionRecord &record)
+{
+    const uint32_t *args = record.args;
+    switch (record.kind)
+    {
+    case DL_VM_CREATE:
+        replay_vms[args[0]] = VM_Create(VMType_t(args[1]), CPUType_t(args[2]));
+        break;
+    case DL_VM_ATTACH:
+        VM_Attach(replay_vms[args[0]], MachineId_t(args[1]));
+        break;
+    case DL_VM_ADD_TASK:
+        VM_AddTask(replay_vms[args[0]], TaskId_t(args[1]), Priority_t(args[2]));
+        break;
+    case DL_VM_REMOVE_TASK:
+        VM_RemoveTask(replay_vms[args[0]], TaskId_t(args[1]));
+        break;
+    case DL_VM_MIGRATE:
+        VM_Migrate(replay_vms[args[0]], MachineId_t(args[1]));
+        break;
+    case DL_VM_SHUTDOWN:
+        VM_Shutdown(replay_vms[args[0]]);
+        break;
+    case DL_MACHINE_SET_STATE:
+        Machine_SetState(MachineId_t(args[0]), MachineState_t(args[1]));
+        break;
+    case DL_SET_TASK_PRIORITY:
+        SetTaskPriority(TaskId_t(args[0]), Priority_t(args[1]));
+        break;
+    case DL_SET_CORE_PERFORMANCE:
+        Machine_SetCorePerformance(MachineId_t(args[0]), args[1], CPUPerformance_t(args[2]));
+        break;
+    default:
+        ThrowException("ReplayAction(): Unexpected record " + DecisionToString(record));
+    }
+}
+// Records a callback, or replays the actions recorded for it. Returns true when the caller must skip the policy.
+static bool DecisionCallback(DecisionKind kind, Time_t time, unsigned arg = 0)
+{
+    if (DECISION_LOG_MODE == LOG_RECORD)
+        RecordDecision(kind, time, arg);
+    if (DECISION_LOG_MODE != LOG_REPLAY)
+        return false;
+
+    if (replay_next == 0 && replay_records.empty() && !ReadDecisionLog(DECISION_LOG_PATH, replay_records))
+        ThrowException("DecisionCallback(): Cannot read " + string(DECISION_LOG_PATH));
+    DecisionRecord expected{time, kind, {arg, 0, 0}};
+    if (replay_next >= replay_records.size() || memcmp(&replay_records[replay_next], &expected, sizeof(expected)) != 0)
+    {
+        ThrowException("DecisionCallback(): Replay diverged at record " + to_string(replay_next) + ", simulator called " +
+                       DecisionToString(expected) + " but the log has " +
+                       (replay_next < replay_records.size() ? DecisionToString(replay_records[replay_next]) : string("nothing left")));
+    }
+    for (replay_next++; replay_next < replay_records.size() && replay_records[replay_next].kind >= DL_FIRST_ACTION; replay_next++)
+    {
+        ReplayAction(replay_records[replay_next]);
+    }
+    return true;
+}
+static void Machine_TransitionState(MachineId_t machine_id, MachineState_t state)
+{
+    RecordDecision(DL_MACHINE_SET_STATE, Now(), machine_id, state);
+    MachineState_t from = machine_id < requested_state.size() ? requested_state[machine_id] : S0;
+    Machine_SetState(machine_id, state);
+    pending_transition_count[machine_id]++;
+    if (machine_id < requested_state.size())
+        requested_state[machine_id] = state;
+    UpdateWakeable(machine_id);
+    if (state == S0)
+    {
+        wake_requests.emplace(machine_id, WakeRequest{Now(), from});
+        EndIdlePeriod(machine_id, Now());
+    }
+    else
+    {
+        wake_requests.erase(machine_id);
+    }
+    UpdateMachineSummary(machine_id);
+}
+unsigned GetProjectedMemoryUsed(MachineId_t machine_id)
+{
+    MachineInfo_t machine_info = Machine_GetInfo(machine_id);
+    unsigned projected_memory = machine_info.memory_used;
+
+    for (const auto &migration : pending_migrations)
+    {
+        if (migration.target_machine == machine_id)
+        {
+            projected_memory += migration.memory_impact; // Incoming VM
+        }
+        else if (migration.source_machine == machine_id)
+        {
+            projected_memory -= migration.memory_impact; // Outgoing VM
+        }
+    }
+    return projected_memory;
+}
+static void InitMachineClasses()
+{
+    // Intern one descriptor per distinct machine configuration
+    typedef tuple<CPUType_t, bool, unsigned, unsigned, vector<unsigned>, vector<unsigned>, vector<unsigned>, vector<unsigned>> ClassKey;
+    map<ClassKey, MachineClassId_t> interned;
+    unsigned total_machines = Machine_GetTotal();
+    machine_classes = vector<MachineClass>();
+    machine_class_of = vector<MachineClassId_t>(total_machines);
+    for (unsigned i = 0; i < total_machines; i++)
+    {
+        MachineInfo_t info = Machine_GetInfo(MachineId_t(i));
+        ClassKey key{info.cpu, info.gpus, info.num_cpus, info.memory_size, info.performance, info.c_states, info.p_states, info.s_states};
+        auto it = interned.find(key);
+        if (it == interned.end())
+        {
+            MachineClassId_t class_id = MachineClassId_t(machine_classes.size());
+            machine_classes.push_back({class_id, info.cpu, info.gpus, info.num_cpus, info.memory_size,
+                                       info.performance, info.c_states, info.p_states, info.s_states, {}});
+            it = interned.emplace(key, class_id).first;
+        }
+        machine_class_of[i] = it->second;
+        machine_classes[it->second].members.push_back(MachineId_t(i));
+    }
+    SimOutput("Scheduler::InitMachineClasses(): Found " + to_string(machine_classes.size()) + " machine classes", 1);
+}
+static inline MachineClassId_t GetMachineClassId(MachineId_t machine_id)
+{
+    return machine_class_of[machine_id];
+}
+static inline const MachineClass &GetMachineClass(MachineId_t machine_id)
+{
+    return machine_classes[machine_class_of[machine_id]];
+}
+// Keeps wakeable_count in step with the machine's requested state and pending transitions
+static void UpdateWakeable(MachineId_t machine_id)
+{
+    if (machine_id >= machine_wakeable.size())
+        return;
+    bool wakeable = requested_state[machine_id] != S0 || pending_transition_count[machine_id] != 0;
+    if (wakeable == machine_wakeable[machine_id])
+        return;
+    machine_wakeable[machine_id] = wakeable;
+    const MachineClass &mclass = GetMachineClass(machine_id);
+    unsigned &count = wakeable_count[{mclass.cpu, mclass.gpus != 0}];
+    count = wakeable ? count + 1 : count - 1;
+}
+// GPU machines are reserved for GPU-capable tasks, so placement and wake-ups look at one pool at a time
+enum GPUPool
+{
+    ANY_POOL,
+    GPU_POOL,
+    NON_GPU_POOL
+};
+static inline GPUPool PoolOf(bool gpus)
+{
+    return gpus ? GPU_POOL : NON_GPU_POOL;
+}
+static inline bool InPool(const MachineClass &mclass, GPUPool pool)
+{
+    return pool == ANY_POOL || PoolOf(mclass.gpus) == pool;
+}
+
+static void InitClusterSummaries()
+{
+    unsigned total_machines = Machine_GetTotal();
+    machine_summaries = vector<ClusterSummary>(total_machines, ClusterSummary{0, 0, 0, 0});
+    machine_wakeable = vector<bool>(total_machines, false);
+    wakeable_count = map<pair<CPUType_t, bool>, unsigned>();
+    machine_class_slot = vector<unsigned>(total_machines);
+    group_summaries = vector<vector<ClusterSummary>>(machine_classes.size());
+    class_summaries = vector<ClusterSummary>(machine_classes.size(), ClusterSummary{0, 0, 0, 0});
+    for (const auto &mclass : machine_classes)
+    {
+        size_t num_groups = (mclass.members.size() + SUMMARY_GROUP_SIZE - 1) / SUMMARY_GROUP_SIZE;
+        group_summaries[mclass.class_id] = vector<ClusterSummary>(num_groups, ClusterSummary{0, 0, 0, 0});
+        for (unsigned slot = 0; slot < mclass.members.size(); slot++)
+        {
+            machine_class_slot[mclass.members[slot]] = slot;
+        }
+    }
+    size_t padded = (total_machines + SCORE_BLOCK - 1) / SCORE_BLOCK * SCORE_BLOCK;
+    machine_columns = MachineColumns{vector<float>(padded, 1), vector<float>(padded, 0), vector<float>(padded, 1),
+                                     vector<float>(padded, 0), vector<float>(padded, 0), vector<int32_t>(padded, -1),
+                                     vector<int32_t>(padded, 0), vector<int32_t>(padded, 0), vector<float>(padded, 0)};
+    machine_task_ends = vector<multiset<Time_t>>(total_machines);
+    placement_scores = vector<float>(padded, HUGE_VALF);
+    for (unsigned i = 0; i < total_machines; i++)
+    {
+        UpdateMachineSummary(MachineId_t(i));
+    }
+}
+static ClusterSummary SummarizeGroup(const MachineClass &mclass, size_t group)
+{
+    ClusterSummary summary{0, 0, 0, 0};
+    size_t end = min(mclass.members.size(), (group + 1) * SUMMARY_GROUP_SIZE);
+    for (size_t slot = group * SUMMARY_GROUP_SIZE; slot < end; slot++)
+    {
+        const ClusterSummary &leaf = machine_summaries[mclass.members[slot]];
+        summary.max_free_memory = max(summary.max_free_memory, leaf.max_free_memory);
+        summary.max_free_cores = max(summary.max_free_cores, leaf.max_free_cores);
+        summary.active_machines += leaf.active_machines;
+        summary.free_memory += leaf.free_memory;
+    }
+    return summary;
+}
+static ClusterSummary SummarizeClass(MachineClassId_t class_id)
+{
+    ClusterSummary summary{0, 0, 0, 0};
+    for (const auto &group : group_summaries[class_id])
+    {
+        summary.max_free_memory = max(summary.max_free_memory, group.max_free_memory);
+        summary.max_free_cores = max(summary.max_free_cores, group.max_free_cores);
+        summary.active_machines += group.active_machines;
+        summary.free_memory += group.free_memory;
+    }
+    return summary;
+}
+static void UpdateMachineSummary(MachineId_t machine_id)
+{
+    if (machine_id >= machine_summaries.size())
+        return; // Summaries not built yet
+
+    MachineInfo_t info = Machine_GetInfo(machine_id);
+    MachineColumns &columns = machine_columns;
+    columns.memory_size[machine_id] = info.memory_size;
+    columns.memory_used[machine_id] = info.memory_used;
+    columns.num_cpus[machine_id] = info.num_cpus;
+    columns.active_tasks[machine_id] = info.active_tasks;
+    columns.core_mips[machine_id] = info.performance.empty() ? 0 : info.performance[P0];
+    columns.cpu[machine_id] = info.cpu;
+    columns.gpus[machine_id] = info.gpus;
+    columns.stable[machine_id] = info.s_state == S0 && pending_transition_count[machine_id] == 0;
+    const multiset<Time_t> &ends = machine_task_ends[machine_id];
+    columns.drain_time[machine_id] = ends.empty() ? 0 : float(double(*ends.rbegin()) / 1000000);
+    if (columns.stable[machine_id] && info.active_tasks == 0)
+        idle_machines.insert(machine_id);
+    else
+        idle_machines.erase(machine_id);
+    UpdateMachinePower(machine_id, info);
+    UpdateWakeable(machine_id);
+    InvalidateEstimate(machine_id);
+
+    ClusterSummary leaf{0, 0, 0, 0};
+    if (info.s_state == S0)
+    {
+        leaf.active_machines = 1;
+        if (pending_transition_count[machine_id] == 0)
+        {
+            // Free memory is an upper bound: policies check either the current or the projected usage
+            unsigned used = min(info.memory_used, GetProjectedMemoryUsed(machine_id));
+            leaf.max_free_memory = info.memory_size > used ? info.memory_size - used : 0;
+            leaf.free_memory = leaf.max_free_memory;
+            leaf.max_free_cores = info.num_cpus > info.active_tasks ? info.num_cpus - info.active_tasks : 0;
+        }
+    }
+    ClusterSummary &old_leaf = machine_summaries[machine_id];
+    if (old_leaf.active_machines != leaf.active_machines)
+    {
+        Time_t now = Now();
+        machine_seconds += double(machines_on) * double(now - machines_on_since) / 1000000;
+        machines_on = machines_on + leaf.active_machines - old_leaf.active_machines;
+        machines_on_since = now;
+    }
+    if (old_leaf.max_free_memory == leaf.max_free_memory && old_leaf.max_free_cores == leaf.max_free_cores &&
+        old_leaf.active_machines == leaf.active_machines)
+        return;
+    old_leaf = leaf;
+    machine_deltas++;
+
+    // Propagate to the group and the class. The class maxima only need a rescan when the group held them and shrank.
+    const MachineClass &mclass = GetMachineClass(machine_id);
+    size_t group_index = machine_class_slot[machine_id] / SUMMARY_GROUP_SIZE;
+    ClusterSummary &group = group_summaries[mclass.class_id][group_index];
+    ClusterSummary &class_summary = class_summaries[mclass.class_id];
+    ClusterSummary old_group = group;
+    group = SummarizeGroup(mclass, group_index);
+    bool memory_shrinks = group.max_free_memory < old_group.max_free_memory && old_group.max_free_memory == class_summary.max_free_memory;
+    bool cores_shrink = group.max_free_cores < old_group.max_free_cores && old_group.max_free_cores == class_summary.max_free_cores;
+    if (memory_shrinks || cores_shrink)
+    {
+        class_summary = SummarizeClass(mclass.class_id);
+    }
+    else
+    {
+        class_summary.max_free_memory = max(class_summary.max_free_memory, group.max_free_memory);
+        class_summary.max_free_cores = max(class_summary.max_free_cores, group.max_free_cores);
+        class_summary.active_machines = class_summary.active_machines - old_group.active_machines + group.active_machines;
+        class_summary.free_memory = class_summary.free_memory - old_group.free_memory + group.free_memory;
+    }
+}
+
+// Visits the stable S0 machines of a CPU type with at least `memory` free, skipping every class and group
+// whose summary cannot fit it. The visitor returns true to stop the search.
+template <typename Visitor>
+static void ForEachFittingMachine(CPUType_t cpu, unsigned memory, Visitor visit)
+{
+    for (const auto &mclass : machine_classes)
+    {
+        if (mclass.cpu != cpu || class_summaries[mclass.class_id].max_free_memory < memory)
+            continue;
+        const vector<ClusterSummary> &groups = group_summaries[mclass.class_id];
+        for (size_t group = 0; group < groups.size(); group++)
+        {
+            if (groups[group].max_free_memory < memory)
+                continue;
+            size_t end = min(mclass.members.size(), (group + 1) * SUMMARY_GROUP_SIZE);
+            for (size_t slot = group * SUMMARY_GROUP_SIZE; slot < end; slot++)
+            {
+                MachineId_t machine_id = mclass.members[slot];
+                if (machine_summaries[machine_id].max_free_memory >= memory && visit(machine_id))
+                    return;
+            }
+        }
+    }
+}
+static inline bool MachineMayFit(MachineId_t machine_id, unsigned memory)
+{
+    return machine_summaries[machine_id].max_free_memory >= memory;
+}
+
+// Migration cost model
+// A migration streams the VM memory, plus the pages dirtied during each pre-copy round, over the NICs of the source
+// and the target. Migrations that share either NIC share its bandwidth, so the slowest side sets the rate.
+static unsigned CountMigrationsInFlight(MachineId_t machine_id)
+{
+    unsigned count = 0;
+    for (const auto &migration : pending_migrations)
+    {
+        if (migration.source_machine == machine_id || migration.target_machine == machine_id)
+            count++;
+    }
+    return count;
+}
+static const vector<PendingMigration> &GetMigrationsInFlight()
+{
+    return pending_migrations;
+}
+// Time to move `vm_memory` MB when `streams` migrations share the busier NIC
+static Time_t MigrationTransferTime(unsigned vm_memory, unsigned streams)
+{
+    double transferred = 0.0;
+    double round = vm_memory;
+    for (unsigned i = 0; i <= MIGRATION_PRECOPY_ROUNDS && round >= 1.0; i++)
+    {
+        transferred += round;
+        round *= MIGRATION_DIRTY_RATE;
+    }
+    return MIGRATION_BASE_LATENCY + Time_t(transferred * streams * 1000000 / MACHINE_NIC_BANDWIDTH);
+}
+// `extra_streams` counts migrations planned but not yet issued on the same NICs
+static Time_t EstimateMigrationTime(unsigned vm_memory, MachineId_t source_machine, MachineId_t target_machine, unsigned extra_streams = 0)
+{
+    unsigned streams = 1 + extra_streams + max(CountMigrationsInFlight(source_machine), CountMigrationsInFlight(target_machine));
+    return MigrationTransferTime(vm_memory, streams);
+}
+// The bandwidth model leaves out the simulator's fixed migration cost, so decisions use at least the observed average
+static Time_t ObservedMigrationTime()
+{
+    return completed_migrations > 0 ? total_migration_time / completed_migrations : MIGRATION_TIME_DEFAULT;
+}
+// Placement actions
+// Thin wrappers over the VM interface that keep the scheduler's VM/task maps and the cluster summaries in sync.
+static double FastestCoreMIPS();
+static double EffectiveMIPS(const TaskInfo_t &task_info, double mips, bool gpus);
+// The target completion, which the frequency planner stretches tasks to, or the runtime left on the fastest core
+// for a task already past it
+static Time_t ExpectedEnd(TaskId_t task_id, Time_t now)
+{
+    TaskInfo_t task_info = GetTaskInfo(task_id);
+    if (task_info.target_completion > now)
+        return task_info.target_completion;
+    return now + Time_t(task_info.remaining_instructions / max(EffectiveMIPS(task_info, FastestCoreMIPS(), false), 1.0));
+}
+static void ForgetTaskEnd(TaskId_t task_id, MachineId_t machine_id)
+{
+    auto it = task_end.find(task_id);
+    if (it == task_end.end())
+        return;
+    multiset<Time_t> &ends = machine_task_ends[machine_id];
+    auto end = ends.find(it->second);
+    if (end != ends.end())
+        ends.erase(end);
+    task_end.erase(it);
+}
+static VMId_t CreateVM(VMType_t vm_type, CPUType_t cpu, MachineId_t machine_id)
+{
+    VMId_t vm_id = VM_Create(vm_type, cpu);
+    RecordDecision(DL_VM_CREATE, Now(), vm_id, vm_type, cpu);
+    RecordDecision(DL_VM_ATTACH, Now(), vm_id, machine_id);
+    VM_Attach(vm_id, machine_id);
+    p_vms->push_back(vm_id);
+    warm_misses++;
+    vm_machine[vm_id] = machine_id;
+    EndIdlePeriod(machine_id, Now());
+    UpdateMachineSummary(machine_id);
+    return vm_id;
+}
+static void AddTaskToVM(VMId_t vm_id, TaskId_t task_id, Priority_t priority)
+{
+    RecordDecision(DL_VM_ADD_TASK, Now(), vm_id, task_id, priority);
+    VM_AddTask(vm_id, task_id, priority);
+    warm_hits += warm_vms.erase(vm_id);
+    // A task moved by an SLA rescue is added to its new VM before it leaves the old one, whose machine still holds its end
+    auto previous = task_vm.find(task_id);
+    if (previous != task_vm.end() && previous->second != vm_id)
+        ForgetTaskEnd(task_id, vm_machine[previous->second]);
+    task_vm[task_id] = vm_id;
+    task_priority[task_id] = priority;
+    MachineId_t machine_id = vm_machine[vm_id];
+    if (machine_id < idle_history.size())
+        idle_history[machine_id].role = min(idle_history[machine_id].role, RequiredSLA(task_id));
+    if (machine_id < machine_task_ends.size())
+    {
+        Time_t end = ExpectedEnd(task_id, Now());
+        task_end[task_id] = end;
+        machine_task_ends[machine_id].insert(end);
+    }
+    UpdateMachineSummary(machine_id);
+}
+static void ShutdownVM(VMId_t vm_id);
+static bool IsVMMigrating(VMId_t vm_id);
+// Adds a VM that just lost its last task to the warm pool, shutting down the oldest warm VM of the same machine and
+// type once the pool is over WARM_VMS_PER_TYPE. `leaving` is a task the simulator may still list on the VM.
+static void NoteVMIdle(VMId_t vm_id, TaskId_t leaving, Time_t now)
+{
+    VMInfo_t vm_info = VM_GetInfo(vm_id);
+    if (any_of(vm_info.active_tasks.begin(), vm_info.active_tasks.end(), [&](TaskId_t tid)
+               { return tid != leaving; }) ||
+        IsVMMigrating(vm_id))
+        return;
+    warm_vms[vm_id] = WarmVM{vm_info.machine_id, vm_info.vm_type, now};
+
+    VMId_t oldest = VMId_t(-1);
+    unsigned pooled = 0;
+    for (const auto &[warm_id, warm] : warm_vms)
+    {
+        if (warm.machine_id != vm_info.machine_id || warm.vm_type != vm_info.vm_type)
+            continue;
+        pooled++;
+        if (oldest == VMId_t(-1) || warm.idle_since < warm_vms[oldest].idle_since)
+            oldest = warm_id;
+    }
+    if (pooled > WARM_VMS_PER_TYPE)
+    {
+        ShutdownVM(oldest);
+        p_vms->erase(remove(p_vms->begin(), p_vms->end(), oldest), p_vms->end());
+        warm_expired++;
+    }
+}
+// Shuts down the warm VMs idle for longer than WARM_VM_TTL
+static void ExpireWarmVMs(Time_t now)
+{
+    vector<VMId_t> expired;
+    for (const auto &[vm_id, warm] : warm_vms)
+    {
+        if (now - warm.idle_since > WARM_VM_TTL && !IsVMMigrating(vm_id))
+            expired.push_back(vm_id);
+    }
+    for (auto vm_id : expired)
+    {
+        SimOutput("ExpireWarmVMs(): Shutting down VM " + to_string(vm_id) + " after " + to_string(now - warm_vms[vm_id].idle_since) + " us idle", 2);
+        ShutdownVM(vm_id);
+        p_vms->erase(remove(p_vms->begin(), p_vms->end(), vm_id), p_vms->end());
+        warm_expired++;
+    }
+}
+static void RemoveTaskFromVM(VMId_t vm_id, TaskId_t task_id)
+{
+    RecordDecision(DL_VM_REMOVE_TASK, Now(), vm_id, task_id);
+    VM_RemoveTask(vm_id, task_id);
+    auto it = task_vm.find(task_id);
+    if (it != task_vm.end() && it->second == vm_id)
+    {
+        task_vm.erase(it);
+        ForgetTaskEnd(task_id, vm_machine[vm_id]);
+    }
+    NoteVMIdle(vm_id, task_id, Now());
+    UpdateMachineSummary(vm_machine[vm_id]);
+}
+static void MigrateVM(VMId_t vm_id, MachineId_t source_machine, MachineId_t target_machine, unsigned vm_memory)
+{
+    Time_t now = Now();
+    Time_t estimate = EstimateMigrationTime(vm_memory, source_machine, target_machine);
+    RecordDecision(DL_VM_MIGRATE, now, vm_id, target_machine);
+    VM_Migrate(vm_id, target_machine);
+    pending_migrations.push_back({vm_id, source_machine, target_machine, vm_memory, now, now + estimate});
+    vm_machine[vm_id] = target_machine;
+    for (auto task_id : VM_GetInfo(vm_id).active_tasks)
+    {
+        auto it = task_end.find(task_id);
+        if (it == task_end.end())
+            continue;
+        multiset<Time_t> &ends = machine_task_ends[source_machine];
+        auto end = ends.find(it->second);
+        if (end != ends.end())
+            ends.erase(end);
+        machine_task_ends[target_machine].insert(it->second);
+    }
+    UpdateMachineSummary(source_machine);
+    UpdateMachineSummary(target_machine);
+}
+static void ShutdownVM(VMId_t vm_id)
+{
+    RecordDecision(DL_VM_SHUTDOWN, Now(), vm_id);
+    VM_Shutdown(vm_id);
+    warm_vms.erase(vm_id);
+    auto it = vm_machine.find(vm_id);
+    if (it != vm_machine.end())
+    {
+        MachineId_t machine_id = it->second;
+        vm_machine.erase(it);
+        UpdateMachineSummary(machine_id);
+    }
+}
+
+static bool IsVMMigrating(VMId_t vm_id)
+{
+    for (const auto &migration : pending_migrations)
+    {
+        if (migration.vm_id == vm_id)
+            return true;
+    }
+    return false;
+}
+static unsigned GetVMMemory(const VMInfo_t &vm_info)
+{
+    unsigned vm_memory = VM_MEMORY_OVERHEAD;
+    for (auto tid : vm_info.active_tasks)
+    {
+        vm_memory += GetTaskMemory(tid);
+    }
+    return vm_memory;
+}
+
+// MIPS a task effectively gets from a core of the given rating, counting the GPU speedup
+static double EffectiveMIPS(const TaskInfo_t &task_info, double mips, bool gpus)
+{
+    return gpus && task_info.gpu_capable ? mips * GPU_SPEEDUP : mips;
+}
+// Time left for the longest task of a VM at the given MIPS rating, in microseconds
+static Time_t EstimateRemainingTime(const VMInfo_t &vm_info, unsigned mips, bool gpus)
+{
+    Time_t remaining = 0;
+    for (auto tid : vm_info.active_tasks)
+    {
+        TaskInfo_t task_info = GetTaskInfo(tid);
+        remaining = max(remaining, Time_t(task_info.remaining_instructions / EffectiveMIPS(task_info, max(mips, 1u), gpus)));
+    }
+    return remaining;
+}
+// Multi-resource placement scoring
+// Demand and headroom are fractions of the candidate machine: memory, cores, GPU, and MIPS relative to the fastest
+// core in the cluster. Lower scores are better. Machines that would exceed MAX_CORE_OCCUPANCY score HUGE_VAL while
+// another machine of the CPU type can still be woken, so the task waits for it instead of crowding the cores.
+struct ResourceVector
+{
+    double memory;
+    double cores;
+    double gpu;
+    double mips;
+};
+static double FastestCoreMIPS()
+{
+    static double fastest = 0;
+    if (fastest == 0)
+    {
+        for (const auto &mclass : machine_classes)
+        {
+            fastest = max(fastest, mclass.performance.empty() ? 0.0 : double(mclass.performance[P0]) * (mclass.gpus ? GPU_SPEEDUP : 1.0));
+        }
+    }
+    return max(fastest, 1.0);
+}
+static bool MachineCanBeWoken(CPUType_t cpu, GPUPool pool = ANY_POOL)
+{
+    for (bool gpus : {false, true})
+    {
+        auto it = wakeable_count.find({cpu, gpus});
+        if (it != wakeable_count.end() && it->second > 0 && (pool == ANY_POOL || PoolOf(gpus) == pool))
+            return true;
+    }
+    return false;
+}
+// Share of END_ALIGNMENT_HORIZON between a machine's drain time and a task's end, both in seconds; an idle machine
+// has nothing to align with
+static float EndGap(float drain, float end)
+{
+    return drain == 0 ? 1.0f : min(fabs(drain - end) * float(1000000.0 / END_ALIGNMENT_HORIZON), 1.0f);
+}
+static double ScorePlacement(TaskId_t task_id, unsigned memory, const MachineInfo_t &info, Time_t now)
+{
+    if (info.performance.empty())
+        return HUGE_VAL;
+    if (info.active_tasks + 1 > MAX_CORE_OCCUPANCY * info.num_cpus && MachineCanBeWoken(info.cpu))
+        return HUGE_VAL;
+    TaskInfo_t task_info = GetTaskInfo(task_id);
+    double core_mips = EffectiveMIPS(task_info, info.performance[P0], info.gpus);
+    double needed_mips = task_info.target_completion > now ? double(task_info.remaining_instructions) / (task_info.target_completion - now) : core_mips;
+
+    ResourceVector demand{double(memory) / info.memory_size, 1.0 / info.num_cpus, task_info.gpu_capable ? 1.0 : 0.0, needed_mips / FastestCoreMIPS()};
+    ResourceVector headroom{info.memory_size > info.memory_used ? double(info.memory_size - info.memory_used) / info.memory_size : 0.0,
+                            info.num_cpus > info.active_tasks ? double(info.num_cpus - info.active_tasks) / info.num_cpus : 0.0,
+                            info.gpus ? 1.0 : 0.0, core_mips / FastestCoreMIPS()};
+    double alignment = END_ALIGNMENT_WEIGHT * EndGap(machine_columns.drain_time[info.machine_id], float(double(ExpectedEnd(task_id, now)) / 1000000));
+    switch (active_scorer)
+    {
+    case DOT_PRODUCT:
+        return -(demand.memory * headroom.memory + demand.cores * headroom.cores + demand.gpu * headroom.gpu + demand.mips * headroom.mips) + alignment;
+    case L2_NORM:
+        return pow(headroom.memory - demand.memory, 2) + pow(headroom.cores - demand.cores, 2) +
+               pow(headroom.gpu - demand.gpu, 2) + pow(headroom.mips - demand.mips, 2) + alignment;
+    case DOMINANT_FIT:
+        return -max(1 - headroom.memory + demand.memory, 1 - headroom.cores + demand.cores) + alignment;
+    case MEMORY_FIT:
+        return headroom.memory - demand.memory + alignment;
+    }
+    return HUGE_VAL;
+}
+// Column kernels
+// ScorePlacement over every machine at once, reading the machine columns. Infeasible machines (wrong CPU type or
+// pool, not stable, no memory, or over the core cap) score HUGE_VALF. Both kernels compute the same float
+// expressions; the AVX2 one is used when the CPU supports it.
+struct PlacementDemand
+{
+    float memory;      // Memory the placement adds to the machine
+    float gpu;         // 1 for GPU-capable tasks
+    float mips;        // MIPS the task needs to meet its target, relative to FastestCoreMIPS()
+    float fastest;     // FastestCoreMIPS()
+    float end;         // ExpectedEnd() of the task in seconds
+    int32_t cpu;
+    int32_t pool_gpus; // GPU flag the machine must have, or -1 for ANY_POOL
+    bool cap_cores;    // Apply MAX_CORE_OCCUPANCY
+};
+static float ScoreLane(const PlacementDemand &demand, float size, float used, float cores, float active, float mips,
+                       int32_t cpu, int32_t gpus, int32_t stable, float drain)
+{
+    bool feasible = cpu == demand.cpu && stable > 0 && (demand.pool_gpus < 0 || gpus == demand.pool_gpus) &&
+                    used + demand.memory < MAX_UTIL * size && (!demand.cap_cores || active + 1 <= MAX_CORE_OCCUPANCY * cores);
+    if (!feasible)
+        return HUGE_VALF;
+    float demand_memory = demand.memory / size;
+    float demand_cores = 1.0f / cores;
+    float headroom_memory = max(size - used, 0.0f) / size;
+    float headroom_cores = max(cores - active, 0.0f) / cores;
+    float headroom_gpu = float(gpus);
+    float headroom_mips = mips * (gpus > 0 && demand.gpu != 0 ? GPU_SPEEDUP : 1.0f) * (1.0f / demand.fastest);
+    float alignment = END_ALIGNMENT_WEIGHT * EndGap(drain, demand.end);
+    switch (active_scorer)
+    {
+    case DOT_PRODUCT:
+        return -((demand_memory * headroom_memory + demand_cores * headroom_cores) + (demand.gpu * headroom_gpu + demand.mips * headroom_mips)) + alignment;
+    case L2_NORM:
+        return (((headroom_memory - demand_memory) * (headroom_memory - demand_memory) + (headroom_cores - demand_cores) * (headroom_cores - demand_cores)) +
+                ((headroom_gpu - demand.gpu) * (headroom_gpu - demand.gpu) + (headroom_mips - demand.mips) * (headroom_mips - demand.mips))) +
+               alignment;
+    case DOMINANT_FIT:
+        return -max(1 - headroom_memory + demand_memory, 1 - headroom_cores + demand_cores) + alignment;
+    case MEMORY_FIT:
+        return (headroom_memory - demand_memory) + alignment;
+    }
+    return HUGE_VALF;
+}
+static void ScoreColumnsScalar(const PlacementDemand &demand)
+{
+    const MachineColumns &c = machine_columns;
+    for (size_t i = 0; i < c.cpu.size(); i++)
+    {
+        placement_scores[i] = ScoreLane(demand, c.memory_size[i], c.memory_used[i], c.num_cpus[i], c.active_tasks[i],
+                                        c.core_mips[i], c.cpu[i], c.gpus[i], c.stable[i], c.drain_time[i]);
+    }
+}
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static void ScoreColumnsAVX2(const PlacementDemand &demand)
+{
+    const MachineColumns &c = machine_columns;
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 memory = _mm256_set1_ps(demand.memory);
+    const __m256 max_util = _mm256_set1_ps(MAX_UTIL);
+    const __m256 core_cap = _mm256_set1_ps(MAX_CORE_OCCUPANCY);
+    const __m256 demand_gpu = _mm256_set1_ps(demand.gpu);
+    const __m256 demand_mips = _mm256_set1_ps(demand.mips);
+    const __m256 speedup = _mm256_set1_ps(demand.gpu != 0 ? GPU_SPEEDUP : 1.0f);
+    const __m256 inverse_fastest = _mm256_set1_ps(1.0f / demand.fastest);
+    const __m256 infeasible = _mm256_set1_ps(HUGE_VALF);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 end = _mm256_set1_ps(demand.end);
+    const __m256 inverse_horizon = _mm256_set1_ps(float(1000000.0 / END_ALIGNMENT_HORIZON));
+    const __m256 alignment_weight = _mm256_set1_ps(END_ALIGNMENT_WEIGHT);
+    const __m256i zero_i = _mm256_setzero_si256();
+    const __m256i cpu = _mm256_set1_epi32(demand.cpu);
+    const __m256i pool = _mm256_set1_epi32(demand.pool_gpus);
+    for (size_t i = 0; i < c.cpu.size(); i += SCORE_BLOCK)
+    {
+        __m256 size = _mm256_loadu_ps(&c.memory_size[i]);
+        __m256 used = _mm256_loadu_ps(&c.memory_used[i]);
+        __m256 cores = _mm256_loadu_ps(&c.num_cpus[i]);
+        __m256 active = _mm256_loadu_ps(&c.active_tasks[i]);
+        __m256 mips = _mm256_loadu_ps(&c.core_mips[i]);
+        __m256 drain = _mm256_loadu_ps(&c.drain_time[i]);
+        __m256i cpu_lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&c.cpu[i]));
+        __m256i gpu_lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&c.gpus[i]));
+        __m256i stable_lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&c.stable[i]));
+
+        // Feasibility mask
+        __m256i mask_i = _mm256_and_si256(_mm256_cmpeq_epi32(cpu_lanes, cpu), _mm256_cmpgt_epi32(stable_lanes, zero_i));
+        if (demand.pool_gpus >= 0)
+            mask_i = _mm256_and_si256(mask_i, _mm256_cmpeq_epi32(gpu_lanes, pool));
+        __m256 mask = _mm256_castsi256_ps(mask_i);
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(used, memory), _mm256_mul_ps(max_util, size), _CMP_LT_OQ));
+        if (demand.cap_cores)
+            mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(active, one), _mm256_mul_ps(core_cap, cores), _CMP_LE_OQ));
+
+        // Demand and headroom vectors
+        __m256 demand_memory = _mm256_div_ps(memory, size);
+        __m256 demand_cores = _mm256_div_ps(one, cores);
+        __m256 headroom_memory = _mm256_div_ps(_mm256_max_ps(_mm256_sub_ps(size, used), zero), size);
+        __m256 headroom_cores = _mm256_div_ps(_mm256_max_ps(_mm256_sub_ps(cores, active), zero), cores);
+        __m256 headroom_gpu = _mm256_cvtepi32_ps(gpu_lanes);
+        __m256 has_gpus = _mm256_castsi256_ps(_mm256_cmpgt_epi32(gpu_lanes, zero_i));
+        __m256 headroom_mips = _mm256_mul_ps(_mm256_mul_ps(mips, _mm256_blendv_ps(one, speedup, has_gpus)), inverse_fastest);
+        __m256 gap = _mm256_min_ps(_mm256_mul_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(drain, end)), inverse_horizon), one);
+        __m256 alignment = _mm256_mul_ps(alignment_weight, _mm256_blendv_ps(gap, one, _mm256_cmp_ps(drain, zero, _CMP_EQ_OQ)));
+
+        __m256 score = infeasible;
+        switch (active_scorer)
+        {
+        case DOT_PRODUCT:
+        {
+            __m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(demand_memory, headroom_memory), _mm256_mul_ps(demand_cores, headroom_cores)),
+                                       _mm256_add_ps(_mm256_mul_ps(demand_gpu, headroom_gpu), _mm256_mul_ps(demand_mips, headroom_mips)));
+            score = _mm256_add_ps(_mm256_sub_ps(zero, dot), alignment);
+            break;
+        }
+        case L2_NORM:
+        {
+            __m256 d_memory = _mm256_sub_ps(headroom_memory, demand_memory);
+            __m256 d_cores = _mm256_sub_ps(headroom_cores, demand_cores);
+            __m256 d_gpu = _mm256_sub_ps(headroom_gpu, demand_gpu);
+            __m256 d_mips = _mm256_sub_ps(headroom_mips, demand_mips);
+            score = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d_memory, d_memory), _mm256_mul_ps(d_cores, d_cores)),
+                                                _mm256_add_ps(_mm256_mul_ps(d_gpu, d_gpu), _mm256_mul_ps(d_mips, d_mips))),
+                                  alignment);
+            break;
+        }
+        case DOMINANT_FIT:
+        {
+            __m256 memory_after = _mm256_add_ps(_mm256_sub_ps(one, headroom_memory), demand_memory);
+            __m256 cores_after = _mm256_add_ps(_mm256_sub_ps(one, headroom_cores), demand_cores);
+            score = _mm256_add_ps(_mm256_sub_ps(zero, _mm256_max_ps(memory_after, cores_after)), alignment);
+            break;
+        }
+        case MEMORY_FIT:
+            score = _mm256_add_ps(_mm256_sub_ps(headroom_memory, demand_memory), alignment);
+            break;
+        }
+        _mm256_storeu_ps(&placement_scores[i], _mm256_blendv_ps(infeasible, score, mask));
+    }
+}
+#endif
+static bool CPUHasAVX2()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool has_avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    return has_avx2;
+#else
+    return false;
+#endif
+}
+static void ScoreColumns(const PlacementDemand &demand)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (CPUHasAVX2())
+    {
+        ScoreColumnsAVX2(demand);
+        return;
+    }
+#endif
+    ScoreColumnsScalar(demand);
+}
+static PlacementDemand MakePlacementDemand(TaskId_t task_id, unsigned memory, CPUType_t cpu, GPUPool pool, Time_t now)
+{
+    TaskInfo_t task_info = GetTaskInfo(task_id);
+    double fastest = FastestCoreMIPS();
+    // Without a deadline left the task asks for a whole fastest core, as ScorePlacement does for the candidate's own
+    double needed_mips = task_info.target_completion > now ? double(task_info.remaining_instructions) / (task_info.target_completion - now) : fastest;
+    return PlacementDemand{float(memory), task_info.gpu_capable ? 1.0f : 0.0f, float(needed_mips / fastest), float(fastest),
+                           float(double(ExpectedEnd(task_id, now)) / 1000000), int32_t(cpu), pool == ANY_POOL ? -1 : int32_t(pool == GPU_POOL), MachineCanBeWoken(cpu)};
+}
+// Lowest index with the lowest score in placement_scores, or MachineId_t(-1) when every machine is infeasible
+static MachineId_t BestScoredMachine()
+{
+    MachineId_t best = MachineId_t(-1);
+    float best_score = HUGE_VALF;
+    for (size_t i = 0; i < placement_scores.size(); i++)
+    {
+        if (placement_scores[i] < best_score)
+        {
+            best_score = placement_scores[i];
+            best = MachineId_t(i);
+        }
+    }
+    return best;
+}
+// Times the scalar path through Machine_GetInfo against both column kernels on a synthetic request per CPU type
+static void BenchmarkPlacementKernels()
+{
+    using Clock = chrono::steady_clock;
+    for (CPUType_t cpu : {ARM, POWER, RISCV, X86})
+    {
+        if (none_of(machine_classes.begin(), machine_classes.end(), [&](const MachineClass &mclass)
+                    { return mclass.cpu == cpu; }))
+            continue;
+        PlacementDemand demand{1024, 0, 0.1f, float(FastestCoreMIPS()), float(double(Now()) / 1000000), int32_t(cpu), -1, false};
+        MachineId_t winners[3] = {MachineId_t(-1), MachineId_t(-1), MachineId_t(-1)};
+        double elapsed[3] = {0, 0, 0};
+        for (unsigned round = 0; round < PLACEMENT_BENCHMARK_ROUNDS; round++)
+        {
+            Clock::time_point start = Clock::now();
+            float best_score = HUGE_VALF;
+            for (unsigned i = 0; i < Machine_GetTotal(); i++)
+            {
+                MachineInfo_t info = Machine_GetInfo(MachineId_t(i));
+                float score = ScoreLane(demand, info.memory_size, info.memory_used, info.num_cpus, info.active_tasks,
+                                        info.performance.empty() ? 0 : info.performance[P0], info.cpu, info.gpus,
+                                        info.s_state == S0 && pending_transition_count[MachineId_t(i)] == 0,
+                                        machine_columns.drain_time[i]);
+                if (score < best_score)
+                {
+                    best_score = score;
+                    winners[0] = MachineId_t(i);
+                }
+            }
+            elapsed[0] += chrono::duration<double, micro>(Clock::now() - start).count();
+
+            start = Clock::now();
+            ScoreColumnsScalar(demand);
+            winners[1] = BestScoredMachine();
+            elapsed[1] += chrono::duration<double, micro>(Clock::now() - start).count();
+
+            start = Clock::now();
+            ScoreColumns(demand);
+            winners[2] = BestScoredMachine();
+            elapsed[2] += chrono::duration<double, micro>(Clock::now() - start).count();
+        }
+        double rounds = PLACEMENT_BENCHMARK_ROUNDS;
+        cout << "Placement scoring, CPU " << cpu << ": Machine_GetInfo " << elapsed[0] / rounds
+             << " us, scalar columns " << elapsed[1] / rounds << " us, "
+             << (CPUHasAVX2() ? "AVX2" : "scalar") << " columns " << elapsed[2] / rounds << " us per request"
+             << (winners[0] == winners[1] && winners[1] == winners[2] ? "" : " (paths disagree)") << endl;
+    }
+}
+static bool MachineCanPowerOff(MachineId_t machine_id)
+{
+    return CURRENT_ALGORITHM != GREEDY || machine_id >= MIN_ACTIVE_MACHINES_GREEDY;
+}
+
+// Consolidation planner
+// Repacks the VMs of the least loaded machines into fuller machines of the same CPU type with best-fit decreasing.
+// A machine is only evacuated when every one of its VMs finds a target and is worth moving, that is its migration,
+// taken as the larger of the model and the observed average, finishes before its tasks would. Cheapest machines to
+// empty go first so a bounded batch frees as many as possible.
+//
+// Planning works on a snapshot taken at a periodic check and never calls into the simulator, so with
+// ASYNC_CONSOLIDATION it runs on a background thread while the simulation goes on. The plan is applied at the next
+// periodic check, whatever the thread's timing, so runs stay deterministic. Moves that no longer match the live state
+// are dropped there, together with the rest of their source machine's evacuation.
+struct ConsolidationBin
+{
+    MachineId_t machine_id;
+    CPUType_t cpu;
+    unsigned capacity;
+    unsigned used;
+    unsigned mips;
+    unsigned in_flight;                          // Migrations using the machine's NIC
+    vector<tuple<VMId_t, unsigned, Time_t>> vms; // VMs that may move, with their memory footprint and remaining time
+    bool pinned;                                 // Has a VM in flight, cannot be emptied now
+    bool may_power_off;
+    bool source;                                 // Planned to be emptied
+    bool target;                                 // Planned to receive VMs
+};
+struct ConsolidationMove
+{
+    VMId_t vm_id;
+    MachineId_t source_machine;
+    MachineId_t target_machine;
+    unsigned memory;
+};
+static future<vector<ConsolidationMove>> consolidation_plan; // Plan being computed since the last periodic check
+static unsigned consolidation_plans = 0;
+static unsigned consolidation_moves = 0;
+static unsigned stale_consolidation_moves = 0;
+
+static vector<ConsolidationBin> TakeConsolidationSnapshot()
+{
+    vector<ConsolidationBin> bins;
+    map<MachineId_t, size_t> bin_of;
+    for (auto machine_id : *p_machines)
+    {
+        if (machine_summaries[machine_id].active_machines == 0 || pending_transition_count[machine_id] != 0)
+            continue;
+        MachineInfo_t info = Machine_GetInfo(machine_id);
+        unsigned used = GetProjectedMemoryUsed(machine_id);
+        if (info.s_state != S0 || used == 0)
+            continue;
+        bin_of[machine_id] = bins.size();
+        bins.push_back({machine_id, info.cpu, info.memory_size, used, info.performance[info.p_state], CountMigrationsInFlight(machine_id), {}, false,
+                        MachineCanPowerOff(machine_id), false, false});
+    }
+    for (const auto &migration : pending_migrations)
+    {
+        for (auto machine_id : {migration.source_machine, migration.target_machine})
+        {
+            auto it = bin_of.find(machine_id);
+            if (it != bin_of.end())
+                bins[it->second].pinned = true;
+        }
+    }
+    for (auto vm_id : *p_vms)
+    {
+        auto it = bin_of.find(vm_machine[vm_id]);
+        if (it == bin_of.end() || IsVMMigrating(vm_id))
+            continue;
+        VMInfo_t vm_info = VM_GetInfo(vm_id);
+        if (vm_info.active_tasks.empty())
+            continue; // Idle VMs are shut down by the periodic check, not moved
+        ConsolidationBin &bin = bins[it->second];
+        Time_t remaining = EstimateRemainingTime(vm_info, bin.mips, GetMachineClass(bin.machine_id).gpus);
+        bin.vms.emplace_back(vm_id, GetVMMemory(vm_info), remaining);
+    }
+    return bins;
+}
+// `observed_migration` is ObservedMigrationTime() at the snapshot, which the planner thread may not read itself
+static vector<ConsolidationMove> ComputeConsolidationPlan(vector<ConsolidationBin> bins, Time_t observed_migration)
+{
+    // Sources: fewest VMs first, then least memory
+    vector<size_t> sources;
+    for (size_t i = 0; i < bins.size(); i++)
+    {
+        if (!bins[i].pinned && !bins[i].vms.empty() && bins[i].may_power_off)
+            sources.push_back(i);
+    }
+    sort(sources.begin(), sources.end(), [&](size_t a, size_t b)
+         { return make_pair(bins[a].vms.size(), bins[a].used) < make_pair(bins[b].vms.size(), bins[b].used); });
+
+    struct Move
+    {
+        VMId_t vm_id;
+        size_t source;
+        size_t target;
+        unsigned memory;
+    };
+    vector<Move> plan;
+    for (auto source : sources)
+    {
+        ConsolidationBin &src = bins[source];
+        if (src.target || plan.size() + src.vms.size() > MAX_MIGRATIONS_PER_PLAN)
+            continue;
+
+        sort(src.vms.begin(), src.vms.end(), [](const tuple<VMId_t, unsigned, Time_t> &a, const tuple<VMId_t, unsigned, Time_t> &b)
+             { return get<1>(a) > get<1>(b); });
+        vector<Move> moves;
+        map<size_t, unsigned> extra; // Memory tentatively added to each target
+        bool feasible = true;
+        for (auto &[vm_id, vm_memory, remaining] : src.vms)
+        {
+            size_t best = bins.size();
+            unsigned best_left = UINT_MAX;
+            for (size_t t = 0; t < bins.size(); t++)
+            {
+                const ConsolidationBin &dst = bins[t];
+                if (t == source || dst.source || dst.cpu != src.cpu || dst.used < src.used)
+                    continue;
+                auto added = extra.find(t); // Only targets that received memory may have an entry
+                unsigned load = dst.used + (added == extra.end() ? 0 : added->second) + vm_memory;
+                if ((float)load / dst.capacity < MAX_UTIL && dst.capacity - load < best_left)
+                {
+                    best_left = dst.capacity - load;
+                    best = t;
+                }
+            }
+            if (best == bins.size())
+            {
+                feasible = false;
+                break;
+            }
+            // The VMs leaving this source share its NIC, and possibly the target's, with the moves planned so far
+            unsigned streams = unsigned(moves.size());
+            for (const auto &move : plan)
+            {
+                if (move.target == best || move.source == best)
+                    streams++;
+            }
+            streams += 1 + max(src.in_flight, bins[best].in_flight);
+            if (max(MigrationTransferTime(vm_memory, streams), observed_migration) >= remaining)
+            {
+                feasible = false; // The VM finishes sooner than it would move
+                break;
+            }
+            extra[best] += vm_memory;
+            moves.push_back({vm_id, source, best, vm_memory});
+        }
+        if (!feasible)
+            continue;
+
+        src.source = true;
+        for (auto &[t, memory] : extra)
+        {
+            bins[t].used += memory;
+            bins[t].target = true;
+        }
+        plan.insert(plan.end(), moves.begin(), moves.end());
+    }
+
+    vector<ConsolidationMove> result;
+    for (const auto &move : plan)
+    {
+        result.push_back({move.vm_id, bins[move.source].machine_id, bins[move.target].machine_id, move.memory});
+    }
+    return result;
+}
+static bool MachineReadyForMigration(MachineId_t machine_id)
+{
+    return pending_transition_count[machine_id] == 0 && Machine_GetInfo(machine_id).s_state == S0;
+}
+// Issues the moves that still hold. A source machine is evacuated entirely or not at all: it must still be idle
+// otherwise, and every one of its VMs must still run tasks on it, fit its target and be worth moving.
+static void ApplyConsolidationPlan(const vector<ConsolidationMove> &plan, Time_t now)
+{
+    map<MachineId_t, vector<ConsolidationMove>> evacuations;
+    for (const auto &move : plan)
+    {
+        evacuations[move.source_machine].push_back(move);
+    }
+    for (const auto &[source_machine, moves] : evacuations)
+    {
+        bool valid = MachineReadyForMigration(source_machine) && CountMigrationsInFlight(source_machine) == 0;
+        set<VMId_t> planned;
+        for (const auto &move : moves)
+        {
+            planned.insert(move.vm_id);
+        }
+        for (auto vm_id : *p_vms)
+        {
+            if (valid && vm_machine[vm_id] == source_machine && !planned.count(vm_id) && !VM_GetInfo(vm_id).active_tasks.empty())
+                valid = false; // New work landed on the source since the snapshot
+        }
+        map<MachineId_t, unsigned> added; // Earlier evacuations are already in the projected memory through pending_migrations
+        for (size_t i = 0; valid && i < moves.size(); i++)
+        {
+            const ConsolidationMove &move = moves[i];
+            MachineId_t target_machine = move.target_machine;
+            if (vm_machine[move.vm_id] != source_machine || IsVMMigrating(move.vm_id) || !MachineReadyForMigration(target_machine))
+            {
+                valid = false;
+                break;
+            }
+            VMInfo_t vm_info = VM_GetInfo(move.vm_id);
+            MachineInfo_t source_info = Machine_GetInfo(source_machine);
+            unsigned load = GetProjectedMemoryUsed(target_machine) + added[target_machine] + move.memory;
+            valid = !vm_info.active_tasks.empty() && (float)load / Machine_GetInfo(target_machine).memory_size < MAX_UTIL &&
+                    max(EstimateMigrationTime(move.memory, source_machine, target_machine, unsigned(i)), ObservedMigrationTime()) <
+                        EstimateRemainingTime(vm_info, source_info.performance[source_info.p_state], GetMachineClass(source_machine).gpus);
+            added[target_machine] += move.memory;
+        }
+        if (!valid)
+        {
+            stale_consolidation_moves += unsigned(moves.size());
+            SimOutput("Scheduler::ApplyConsolidationPlan(): Dropping the stale evacuation of machine " + to_string(source_machine), 2);
+            continue;
+        }
+        for (const auto &move : moves)
+        {
+            MigrateVM(move.vm_id, source_machine, move.target_machine, move.memory);
+            consolidation_moves++;
+            SimOutput("Scheduler::ApplyConsolidationPlan(): Migrating VM " + to_string(move.vm_id) + " from machine " +
+                          to_string(source_machine) + " to " + to_string(move.target_machine) + " at time " + to_string(now),
+                      1);
+        }
+    }
+}
+// Called by the periodic checks: applies the plan started at the previous check, then starts a new one if requested
+static void PlanConsolidation(Time_t now)
+{
+    if (consolidation_plan.valid())
+        ApplyConsolidationPlan(consolidation_plan.get(), now);
+    if (!consolidation_requested)
+        return;
+    consolidation_requested = false;
+    consolidation_plans++;
+    if (ASYNC_CONSOLIDATION)
+        consolidation_plan = async(launch::async, ComputeConsolidationPlan, TakeConsolidationSnapshot(), ObservedMigrationTime());
+    else
+        ApplyConsolidationPlan(ComputeConsolidationPlan(TakeConsolidationSnapshot(), ObservedMigrationTime()), now);
+}
+
+// Demand forecast and wake-ups
+static void RecordArrival(TaskId_t task_id)
+{
+    DemandForecast &forecast = demand_forecasts[{RequiredCPUType(task_id), RequiredVMType(task_id)}];
+    forecast.window_arrivals++;
+    forecast.window_memory += GetTaskMemory(task_id);
+}
+static void UpdateDemandForecasts(Time_t now)
+{
+    if (now <= forecast_window_start)
+        return;
+    check_interval = now - forecast_window_start;
+    for (auto &[key, forecast] : demand_forecasts)
+    {
+        double observed_rate = double(forecast.window_arrivals) / check_interval;
+        forecast.rate = FORECAST_ALPHA * observed_rate + (1 - FORECAST_ALPHA) * forecast.rate;
+        if (forecast.window_arrivals > 0)
+        {
+            double observed_memory = double(forecast.window_memory) / forecast.window_arrivals;
+            forecast.task_memory = forecast.task_memory == 0 ? observed_memory
+                                                             : FORECAST_ALPHA * observed_memory + (1 - FORECAST_ALPHA) * forecast.task_memory;
+        }
+        forecast.window_arrivals = 0;
+        forecast.window_memory = 0;
+    }
+    forecast_window_start = now;
+}
+// Memory the arrivals for a CPU type are expected to need before a machine woken now could take them
+static double PredictedMemoryDemand(CPUType_t cpu)
+{
+    double horizon = wake_latency[S5] + check_interval;
+    double demand = 0;
+    for (const auto &[key, forecast] : demand_forecasts)
+    {
+        if (key.first == cpu && forecast.rate > 0)
+        {
+            demand += forecast.rate * horizon * forecast.task_memory + VM_MEMORY_OVERHEAD;
+        }
+    }
+    return demand;
+}
+// Free memory of the stable machines of a CPU type plus the capacity of the machines already waking up
+static double AvailableMemory(CPUType_t cpu)
+{
+    double available = 0;
+    for (const auto &mclass : machine_classes)
+    {
+        if (mclass.cpu == cpu)
+            available += class_summaries[mclass.class_id].free_memory;
+    }
+    for (const auto &[machine_id, requested] : wake_requests)
+    {
+        const MachineClass &mclass = GetMachineClass(machine_id);
+        if (mclass.cpu == cpu)
+            available += mclass.memory_size;
+    }
+    return available;
+}
+// Called before the policy handler consumes the completed transition
+static void RecordStateChange(Time_t time, MachineId_t machine_id)
+{
+    auto it = wake_requests.find(machine_id);
+    if (it != wake_requests.end() && pending_transition_count[machine_id] <= 1 && Machine_GetInfo(machine_id).s_state == S0)
+    {
+        const WakeRequest &request = it->second;
+        if (request.from != S0)
+        {
+            double observed = double(time - request.requested);
+            wake_latency[request.from] = FORECAST_ALPHA * observed + (1 - FORECAST_ALPHA) * wake_latency[request.from];
+        }
+        wake_requests.erase(it);
+    }
+}
+// The settled sleeping machine of a CPU type and pool that wakes fastest, or -1 when none is asleep. `capped` is set
+// when a sleeper was passed over because waking it would cross a power cap.
+static MachineId_t ShallowestSleepingMachine(CPUType_t cpu, GPUPool pool, bool &capped)
+{
+    MachineId_t shallowest = MachineId_t(-1);
+    bool type_running = CPUTypeRunning(cpu);
+    capped = false;
+    for (const auto &mclass : machine_classes)
+    {
+        if (mclass.cpu != cpu || !InPool(mclass, pool))
+            continue;
+        for (auto machine_id : mclass.members)
+        {
+            if (requested_state[machine_id] == S0 || pending_transition_count[machine_id] != 0)
+                continue;
+            if (!WakeFitsPowerCap(machine_id, type_running))
+            {
+                capped = true;
+                continue;
+            }
+            if (shallowest == MachineId_t(-1) || requested_state[machine_id] < requested_state[shallowest])
+                shallowest = machine_id;
+        }
+    }
+    return shallowest;
+}
+// Makes sure a machine of the CPU type is on its way to S0: joins one already waking up or wakes the shallowest
+// sleeper. Machines still going to sleep are left alone, since the simulator livelocks when a transition is
+// re-requested before it completes; the state-change handlers retry once they settle. Returns false when no
+// machine of the type can be woken right now.
+static bool WakeMachineFor(CPUType_t cpu, GPUPool pool = ANY_POOL)
+{
+    for (const auto &[machine_id, request] : wake_requests)
+    {
+        const MachineClass &mclass = GetMachineClass(machine_id);
+        if (mclass.cpu == cpu && InPool(mclass, pool))
+            return true;
+    }
+    bool capped;
+    MachineId_t machine_id = ShallowestSleepingMachine(cpu, pool, capped);
+    if (machine_id == MachineId_t(-1))
+    {
+        if (capped)
+            RecordWakeRefused();
+        return false;
+    }
+    Machine_TransitionState(machine_id, S0);
+    SimOutput("Scheduler::WakeMachineFor(): Turning on machine " + to_string(machine_id), 1);
+    return true;
+}
+// Tasks left pending after a state change (the machine went off, or filled up) need another machine on its way
+static void WakeForPendingTasks()
+{
+    set<CPUType_t> waiting_cpus;
+    for (auto task_id : pending_tasks)
+    {
+        waiting_cpus.insert(RequiredCPUType(task_id));
+    }
+    for (auto cpu : waiting_cpus)
+    {
+        WakeMachineFor(cpu);
+    }
+}
+// Wakes machines ahead of the forecast demand so arrivals do not wait for a whole wake-up latency
+static void PreWakeMachines(Time_t now)
+{
+    set<CPUType_t> cpus;
+    for (const auto &[key, forecast] : demand_forecasts)
+    {
+        cpus.insert(key.first);
+    }
+    for (auto cpu : cpus)
+    {
+        double deficit = PredictedMemoryDemand(cpu) - AvailableMemory(cpu);
+        for (unsigned woken = 0; deficit > 0 && woken < MAX_PREWAKE_PER_CHECK; woken++)
+        {
+            bool capped;
+            MachineId_t candidate = ShallowestSleepingMachine(cpu, ANY_POOL, capped);
+            if (candidate == MachineId_t(-1))
+                break; // Every machine of this type is on or changing state
+            Machine_TransitionState(candidate, S0);
+            deficit -= GetMachineClass(candidate).memory_size;
+            SimOutput("Scheduler::PreWakeMachines(): Turning on machine " + to_string(candidate) + " ahead of demand at time " + to_string(now), 1);
+        }
+    }
+}
+// True when turning the machine off would leave less free memory than the forecast needs. `parked` is the free
+// memory already given up by machines turned off during the current check.
+static bool NeededForForecast(MachineId_t machine_id, map<CPUType_t, double> &parked)
+{
+    CPUType_t cpu = GetMachineClass(machine_id).cpu;
+    double free_after = AvailableMemory(cpu) - parked[cpu] - machine_summaries[machine_id].free_memory;
+    if (free_after < PredictedMemoryDemand(cpu))
+        return true;
+    parked[cpu] += machine_summaries[machine_id].free_memory;
+    return false;
+}
+// Memory-pressure planner
+// Memory each machine hosting VMs will hold once its in-flight migrations land, and the machines set to exceed the
+// pressure threshold by then. Forecast arrivals are left out: placement checks that a task fits before adding it, so
+// they fill machines up to their capacity but never past it, and counting them made full machines trade VMs.
+static map<MachineId_t, double> ProjectMemory()
+{
+    map<MachineId_t, double> projection;
+    for (auto vm_id : *p_vms)
+    {
+        MachineId_t machine_id = vm_machine[vm_id];
+        if (!projection.count(machine_id))
+            projection[machine_id] = GetProjectedMemoryUsed(machine_id);
+    }
+    return projection;
+}
+// Moves VMs off a machine until `excess` memory is freed: the smallest VM that covers it alone, otherwise the largest
+// VMs first. Each goes to the best-fitting machine of its CPU type that stays under the pressure threshold.
+// Returns the number of migrations started, at most `budget`.
+static unsigned EvacuateMachine(MachineId_t machine_id, double excess, map<MachineId_t, double> &projection, unsigned budget, Time_t now)
+{
+    vector<pair<VMId_t, unsigned>> candidates;
+    CPUType_t cpu = GetMachineClass(machine_id).cpu;
+    for (auto vm_id : *p_vms)
+    {
+        if (vm_machine[vm_id] != machine_id || IsVMMigrating(vm_id))
+            continue;
+        VMInfo_t vm_info = VM_GetInfo(vm_id);
+        if (!vm_info.active_tasks.empty()) // Empty VMs are shut down by the periodic check rather than moved
+            candidates.emplace_back(vm_id, GetVMMemory(vm_info));
+    }
+    sort(candidates.begin(), candidates.end(), [](const pair<VMId_t, unsigned> &a, const pair<VMId_t, unsigned> &b)
+         { return a.second > b.second; });
+    auto covering = find_if(candidates.rbegin(), candidates.rend(), [&](const pair<VMId_t, unsigned> &candidate)
+                            { return candidate.second >= excess; });
+    if (covering != candidates.rend())
+        candidates = {*covering};
+
+    unsigned started = 0;
+    for (const auto &[vm_id, vm_memory] : candidates)
+    {
+        if (excess <= 0 || started == budget)
+            break;
+        MachineId_t target = MachineId_t(-1);
+        double least_left = HUGE_VAL;
+        ForEachFittingMachine(cpu, vm_memory,
+                              [&](MachineId_t candidate)
+                              {
+                                  if (candidate == machine_id)
+                                      return false;
+                                  double capacity = MEMORY_PRESSURE_THRESHOLD * GetMachineClass(candidate).memory_size;
+                                  double projected = projection.count(candidate) ? projection[candidate] : GetProjectedMemoryUsed(candidate);
+                                  double left = capacity - projected - vm_memory;
+                                  if (left >= 0 && left < least_left)
+                                  {
+                                      least_left = left;
+                                      target = candidate;
+                                  }
+                                  return false;
+                              });
+        if (target == MachineId_t(-1))
+            continue;
+        double target_projected = projection.count(target) ? projection[target] : GetProjectedMemoryUsed(target);
+        MigrateVM(vm_id, machine_id, target, vm_memory);
+        projection[target] = target_projected + vm_memory;
+        projection[machine_id] -= vm_memory;
+        excess -= vm_memory;
+        started++;
+        SimOutput("Scheduler::EvacuateMachine(): Migrating VM " + to_string(vm_id) + " from machine " + to_string(machine_id) +
+                      " to " + to_string(target) + " at time " + to_string(now),
+                  1);
+    }
+    return started;
+}
+// Handles a memory warning with one evacuation plan for the machine instead of re-placing its tasks one at a time
+static bool EvacuateOvercommitted(MachineId_t machine_id, Time_t now)
+{
+    map<MachineId_t, double> projection = ProjectMemory();
+    MachineInfo_t info = Machine_GetInfo(machine_id);
+    double projected = max(projection.count(machine_id) ? projection[machine_id] : 0.0, double(info.memory_used));
+    projection[machine_id] = projected;
+    double excess = projected - MEMORY_PRESSURE_THRESHOLD * info.memory_size;
+    return excess > 0 && EvacuateMachine(machine_id, excess, projection, MAX_MIGRATIONS_PER_PLAN, now) > 0;
+}
+// Flags the machines whose projected memory is about to overcommit and evacuates them ahead of a memory warning
+static void PlanEvacuations(Time_t now)
+{
+    map<MachineId_t, double> projection = ProjectMemory();
+    unsigned budget = MAX_MIGRATIONS_PER_PLAN;
+    for (auto &[machine_id, projected] : projection)
+    {
+        double excess = projected - MEMORY_PRESSURE_THRESHOLD * GetMachineClass(machine_id).memory_size;
+        if (excess > 0 && budget > 0)
+        {
+            SimOutput("Scheduler::PlanEvacuations(): Machine " + to_string(machine_id) + " projected to use " + to_string(unsigned(projected)) + " MB", 2);
+            budget -= EvacuateMachine(machine_id, excess, projection, budget, now);
+        }
+    }
+}
+
+// Power-state manager
+static double SStatePower(const MachineClass &mclass, MachineState_t state)
+{
+    return mclass.s_states.size() == S_STATES ? mclass.s_states[state] : default_s_state_power[state];
+}
+// Deepest S-state whose break-even time fits the machine's expected idle period and whose wake-up latency fits
+// the SLA it last served. The expected idle period grows with the time already spent idle, so machines step
+// deeper over successive checks.
+static MachineState_t ChooseSleepState(MachineId_t machine_id, Time_t now)
+{
+    const IdleHistory &history = idle_history[machine_id];
+    const MachineClass &mclass = GetMachineClass(machine_id);
+    double expected_idle = max(history.predicted_idle, double(now - history.idle_since));
+    double idle_power = SStatePower(mclass, S0);
+    MachineState_t chosen = S0;
+    for (int state = S0i1; state < S_STATES; state++)
+    {
+        double saving = idle_power - SStatePower(mclass, MachineState_t(state));
+        if (saving <= 0)
+            continue;
+        // Entering and leaving the state each cost about one wake-up latency at idle power
+        double break_even = 2 * wake_latency[state] * idle_power / saving;
+        if (break_even <= expected_idle && wake_latency[state] <= sla_wake_budget[history.role])
+            chosen = MachineState_t(state);
+    }
+    return chosen;
+}
+static void MarkIdle(MachineId_t machine_id, Time_t now)
+{
+    IdleHistory &history = idle_history[machine_id];
+    if (!history.idle)
+    {
+        history.idle = true;
+        history.idle_since = now;
+    }
+}
+// Moves settled sleeping machines into a deeper state once their idle period has outgrown the current one
+static void DeepenSleepStates(Time_t now)
+{
+    for (MachineId_t machine_id = 0; machine_id < requested_state.size(); machine_id++)
+    {
+        MachineState_t current = requested_state[machine_id];
+        if (current == S0 || current == S5 || pending_transition_count[machine_id] != 0 || !idle_history[machine_id].idle)
+            continue;
+        MachineState_t target = ChooseSleepState(machine_id, now);
+        if (target > current)
+        {
+            SimOutput("Scheduler::DeepenSleepStates(): Machine " + to_string(machine_id) + " from S-state " + to_string(current) + " to " + to_string(target), 1);
+            Machine_TransitionState(machine_id, target);
+        }
+    }
+}
+// Completion estimator
+// Predicts when a task would finish on a machine and the energy it would spend there. The task gets the MIPS of the
+// machine's current P-state, shared over the run queue once the queue is longer than the cores, and is charged the
+// power of its core plus its share of the machine's static power. The per-machine part is cached until a task starts
+// or finishes on the machine or its P-state changes.
+struct MachineEstimate
+{
+    bool valid;
+    bool gpus;
+    double task_mips;  // MIPS one more task would get
+    double task_watts; // Power one more task would be charged
+};
+static vector<MachineEstimate> machine_estimates; // Indexed by MachineId_t
+static unsigned estimates_cached = 0;
+static unsigned estimates_computed = 0;
+
+static void InvalidateEstimate(MachineId_t machine_id)
+{
+    if (machine_id < machine_estimates.size())
+        machine_estimates[machine_id].valid = false;
+}
+static const MachineEstimate &GetMachineEstimate(MachineId_t machine_id)
+{
+    if (machine_estimates.size() != machine_summaries.size())
+        machine_estimates = vector<MachineEstimate>(machine_summaries.size(), MachineEstimate{false, false, 0, 0});
+    MachineEstimate &estimate = machine_estimates[machine_id];
+    if (estimate.valid)
+    {
+        estimates_cached++;
+        return estimate;
+    }
+    estimates_computed++;
+    MachineInfo_t info = Machine_GetInfo(machine_id);
+    const MachineClass &mclass = GetMachineClass(machine_id);
+    unsigned run_queue = info.active_tasks + 1;
+    double share = run_queue > info.num_cpus ? double(info.num_cpus) / run_queue : 1.0;
+    double mips = info.p_state < info.performance.size() ? info.performance[info.p_state] : 0;
+    double core_watts = info.p_state < mclass.p_states.size() ? mclass.p_states[info.p_state] : 0;
+    estimate = MachineEstimate{true, info.gpus, mips * share, core_watts * share + SStatePower(mclass, S0) / run_queue};
+    return estimate;
+}
+// Estimated completion time of the task on the machine, with the energy it would spend there in joules
+static Time_t EstimateCompletion(const TaskInfo_t &task_info, MachineId_t machine_id, Time_t now, double &energy)
+{
+    const MachineEstimate &estimate = GetMachineEstimate(machine_id);
+    double runtime = task_info.remaining_instructions / max(EffectiveMIPS(task_info, estimate.task_mips, estimate.gpus), 1.0);
+    energy = estimate.task_watts * runtime / 1000000;
+    return now + Time_t(runtime);
+}
+// Reorders placement candidates, lowest key first. When some candidate is estimated to meet the task's target, the
+// deadline only filters: the others are dropped and the rest keep their fit score, plus the estimated energy with
+// DEADLINE_ENERGY_PLACEMENT. When none does, the earliest completion goes first. Ties keep fit score order.
+// Returns true when the keys are fit scores, false when they are completion times.
+static bool RankByCompletion(TaskId_t task_id, vector<pair<double, MachineId_t>> &candidates, Time_t now)
+{
+    TaskInfo_t task_info = GetTaskInfo(task_id);
+    vector<tuple<double, double, MachineId_t>> meeting;
+    vector<tuple<double, double, MachineId_t>> by_completion;
+    for (const auto &[score, machine_id] : candidates)
+    {
+        double energy;
+        Time_t completion = EstimateCompletion(task_info, machine_id, now, energy);
+        if (completion <= task_info.target_completion)
+            meeting.emplace_back(DEADLINE_ENERGY_PLACEMENT ? energy + score : score, score, machine_id);
+        by_completion.emplace_back(double(completion), score, machine_id);
+    }
+    vector<tuple<double, double, MachineId_t>> &ranked = meeting.empty() ? by_completion : meeting;
+    stable_sort(ranked.begin(), ranked.end(), [](const tuple<double, double, MachineId_t> &a, const tuple<double, double, MachineId_t> &b)
+                { return make_pair(get<0>(a), get<1>(a)) < make_pair(get<0>(b), get<1>(b)); });
+    candidates.clear();
+    for (const auto &[key, score, machine_id] : ranked)
+    {
+        candidates.emplace_back(key, machine_id);
+    }
+    return !meeting.empty();
+}
+// RankByCompletion over the machines the column kernel found feasible, rewriting placement_scores with the keys and
+// marking the dropped machines infeasible. Returns RankByCompletion's key kind, false when nothing was feasible.
+static bool RankScoresByCompletion(TaskId_t task_id, Time_t now)
+{
+    vector<pair<double, MachineId_t>> candidates;
+    for (size_t i = 0; i < placement_scores.size(); i++)
+    {
+        if (placement_scores[i] != HUGE_VALF)
+            candidates.emplace_back(placement_scores[i], MachineId_t(i));
+    }
+    if (candidates.empty())
+        return false;
+    fill(placement_scores.begin(), placement_scores.end(), HUGE_VALF);
+    bool fit_keys = RankByCompletion(task_id, candidates, now);
+    for (const auto &[key, machine_id] : candidates)
+    {
+        placement_scores[machine_id] = float(key);
+    }
+    return fit_keys;
+}
+
+// Power cap
+// Cluster power is estimated from the class tables: the S-state power of every machine plus, in S0, the P-state power
+// of the busy cores and the C1 power of the idle ones. Machines waking up count at S0 from the moment they are asked.
+// When the estimate exceeds CLUSTER_POWER_CAP or the cap POWER_CAP_PATH sets for a CPU type, the cores of the machines
+// serving the loosest SLA step down first and stay floored until the headroom returns. Wake-ups that would cross a cap
+// are refused, and SLA3 arrivals wait in deferred_tasks for at most POWER_CAP_MAX_DEFERRAL.
+static vector<double> cpu_power_caps(X86 + 1, 0); // Watts per CPUType_t, 0 for no cap
+static bool cpu_capped = false;                   // Some CPU type has a cap
+static vector<double> machine_power;
+static vector<CPUPerformance_t> machine_p_state; // As of the last power update, so the cap loop needs no Machine_GetInfo
+static vector<double> cpu_power;
+static double cluster_power = 0;
+static map<MachineId_t, CPUPerformance_t> power_floor; // Slowest P-state each capped machine must stay at
+static vector<pair<TaskId_t, Time_t>> deferred_tasks; // SLA3 arrivals held back by the cap, with their arrival time
+static set<TaskId_t> capped_tasks;                     // Tasks that ran on a floored machine
+static Time_t capped_time = 0;
+static Time_t last_power_check = 0;
+static bool was_capped = false;
+static unsigned power_steps = 0;
+static unsigned wakes_refused = 0;
+static unsigned capped_sla_misses = 0;
+static Time_t total_deferral = 0;
+static unsigned tasks_deferred = 0;
+
+static void LoadPowerCaps()
+{
+    if (string(POWER_CAP_PATH).empty())
+        return;
+    static const map<string, CPUType_t> cpu_names = {{"ARM", ARM}, {"POWER", POWER}, {"RISCV", RISCV}, {"X86", X86}};
+    ifstream file(POWER_CAP_PATH);
+    string name;
+    double watts;
+    while (file >> name >> watts)
+    {
+        auto cpu = cpu_names.find(name);
+        if (cpu == cpu_names.end())
+        {
+            SimOutput("LoadPowerCaps(): Unknown CPU type " + name + " in " + string(POWER_CAP_PATH), 0);
+            continue;
+        }
+        cpu_power_caps[cpu->second] = watts;
+        cpu_capped = cpu_capped || watts > 0;
+    }
+    SimOutput("LoadPowerCaps(): " + string(cpu_capped ? "Per CPU type caps" : "No caps") + " in " + string(POWER_CAP_PATH), 1);
+}
+static double MachinePower(const MachineClass &mclass, MachineState_t state, CPUPerformance_t p_state, unsigned active_tasks)
+{
+    double power = SStatePower(mclass, state);
+    if (state == S0 && p_state < mclass.p_states.size())
+    {
+        unsigned busy_cores = min(active_tasks, mclass.num_cpus);
+        power += busy_cores * mclass.p_states[p_state] + (mclass.num_cpus - busy_cores) * (mclass.c_states.size() > C1 ? mclass.c_states[C1] : 0);
+    }
+    return power;
+}
+static void UpdateMachinePower(MachineId_t machine_id, const MachineInfo_t &info)
+{
+    if (machine_power.size() != machine_summaries.size())
+    {
+        machine_power = vector<double>(machine_summaries.size(), 0);
+        machine_p_state = vector<CPUPerformance_t>(machine_summaries.size(), P0);
+        cpu_power = vector<double>(cpu_power_caps.size(), 0);
+        cluster_power = 0;
+    }
+    const MachineClass &mclass = GetMachineClass(machine_id);
+    MachineState_t state = machine_id < requested_state.size() && requested_state[machine_id] == S0 ? S0 : info.s_state;
+    double power = MachinePower(mclass, state, info.p_state, info.active_tasks);
+    cluster_power += power - machine_power[machine_id];
+    cpu_power[mclass.cpu] += power - machine_power[machine_id];
+    machine_power[machine_id] = power;
+    machine_p_state[machine_id] = info.p_state;
+}
+// True when drawing `extra` more watts on the CPU type keeps the cluster and the type under their caps
+static bool FitsPowerCap(CPUType_t cpu, double extra)
+{
+    if (CLUSTER_POWER_CAP > 0 && cluster_power + extra > CLUSTER_POWER_CAP)
+        return false;
+    return cpu_power_caps[cpu] == 0 || cpu_power[cpu] + extra <= cpu_power_caps[cpu];
+}
+// True when some machine of the CPU type is on or on its way there
+static bool CPUTypeRunning(CPUType_t cpu)
+{
+    return any_of(machine_classes.begin(), machine_classes.end(), [&](const MachineClass &mclass)
+                  { return mclass.cpu == cpu && any_of(mclass.members.begin(), mclass.members.end(), [](MachineId_t member)
+                                                       { return requested_state[member] == S0; }); });
+}
+// A wake-up is always allowed when no machine of the CPU type is on (`type_running`, from CPUTypeRunning), or its
+// tasks could never run. Callers scanning sleepers compute `type_running` once per scan.
+static bool WakeFitsPowerCap(MachineId_t machine_id, bool type_running)
+{
+    if (machine_id >= machine_power.size() || !type_running)
+        return true;
+    const MachineClass &mclass = GetMachineClass(machine_id);
+    return FitsPowerCap(mclass.cpu, MachinePower(mclass, S0, P0, 0) - machine_power[machine_id]);
+}
+// Counts a wake-up the scheduler decided on but the power cap refused
+static void RecordWakeRefused()
+{
+    wakes_refused++;
+}
+static bool PowerCapped()
+{
+    for (size_t cpu = 0; cpu < cpu_power_caps.size(); cpu++)
+    {
+        if (!FitsPowerCap(CPUType_t(cpu), 0))
+            return true;
+    }
+    return !power_floor.empty();
+}
+static void SetMachinePerformance(MachineId_t machine_id, MachineInfo_t &info, CPUPerformance_t p_state, Time_t now)
+{
+    if (p_state == info.p_state)
+        return;
+    for (unsigned core_id = 0; core_id < info.num_cpus; core_id++)
+    {
+        RecordDecision(DL_SET_CORE_PERFORMANCE, now, machine_id, core_id, p_state);
+        Machine_SetCorePerformance(machine_id, core_id, p_state);
+    }
+    info.p_state = p_state;
+    UpdateMachinePower(machine_id, info);
+    InvalidateEstimate(machine_id);
+    SimOutput("Scheduler::SetMachinePerformance(): Machine " + to_string(machine_id) + " cores to P" + to_string(p_state) + " at time " + to_string(now), 2);
+}
+// Frequency planner
+// Among the P-states whose MIPS still lets every task finish by its target completion, runs the cores of a machine at
+// the one that spends the least energy per instruction. That is the slowest feasible one unless the machine's static
+// power outweighs the dynamic savings, in which case finishing early and going idle is cheaper.
+// The simulator keeps all cores of a machine at one P-state, so the plan covers the most demanding task and is
+// applied to every core. Tasks beyond the core count time-share the cores and need proportionally more.
+static void PlanCorePerformance(MachineId_t machine_id, Time_t now)
+{
+    MachineInfo_t info = Machine_GetInfo(machine_id);
+    if (info.s_state != S0 || info.performance.empty() || info.active_tasks == 0)
+        return;
+    double share = info.active_tasks > info.num_cpus ? double(info.num_cpus) / info.active_tasks : 1.0;
+    double required_mips = 0;
+    for (auto vm_id : *p_vms)
+    {
+        if (vm_machine[vm_id] != machine_id)
+            continue;
+        for (auto task_id : VM_GetInfo(vm_id).active_tasks)
+        {
+            TaskInfo_t task_info = GetTaskInfo(task_id);
+            double headroom = sla_dvfs_headroom[task_info.required_sla];
+            if (task_info.completed || headroom == 0)
+                continue;
+            if (task_info.target_completion <= now)
+            {
+                required_mips = HUGE_VAL; // Already late, run flat out
+                break;
+            }
+            double mips = double(task_info.remaining_instructions) / (task_info.target_completion - now); // Instructions per us
+            required_mips = max(required_mips, headroom * mips / share / EffectiveMIPS(task_info, 1.0, info.gpus));
+        }
+    }
+    const MachineClass &mclass = GetMachineClass(machine_id);
+    unsigned busy_cores = min(info.active_tasks, info.num_cpus);
+    double static_power = SStatePower(mclass, S0) + (info.num_cpus - busy_cores) * info.c_states[C1];
+    CPUPerformance_t p_state = P0;
+    double best_energy = HUGE_VAL;
+    for (size_t p = 0; p < info.performance.size(); p++)
+    {
+        if (info.performance[p] < required_mips)
+            break;
+        double energy = (static_power + busy_cores * info.p_states[p]) / (busy_cores * info.performance[p]);
+        if (energy <= best_energy)
+        {
+            best_energy = energy;
+            p_state = CPUPerformance_t(p);
+        }
+    }
+    auto floor = power_floor.find(machine_id);
+    if (floor != power_floor.end())
+        p_state = max(p_state, floor->second);
+    SetMachinePerformance(machine_id, info, p_state, now);
+}
+static void PlaceNewTask(Time_t now, TaskId_t task_id);
+// Steps the cores of busy machines down, loosest SLA first, until the cluster and every class fit their caps, then
+// lifts floors, strictest SLA first, while the headroom allows. Tracks the time spent capped.
+static void EnforcePowerCap(Time_t now)
+{
+    if (CLUSTER_POWER_CAP == 0 && !cpu_capped)
+        return;
+    if (was_capped)
+        capped_time += now - last_power_check;
+    last_power_check = now;
+
+    for (;;)
+    {
+        bool cluster_over = CLUSTER_POWER_CAP > 0 && cluster_power > CLUSTER_POWER_CAP;
+        MachineId_t victim = MachineId_t(-1);
+        for (MachineId_t machine_id = 0; machine_id < machine_power.size(); machine_id++)
+        {
+            const MachineClass &mclass = GetMachineClass(machine_id);
+            if (!cluster_over && FitsPowerCap(mclass.cpu, 0))
+                continue;
+            if (machine_summaries[machine_id].active_machines == 0 || idle_history[machine_id].idle)
+                continue;
+            if (machine_columns.active_tasks[machine_id] == 0 || machine_p_state[machine_id] + 1 >= int(mclass.performance.size()))
+                continue;
+            if (victim == MachineId_t(-1) || idle_history[machine_id].role > idle_history[victim].role)
+                victim = machine_id;
+        }
+        if (victim == MachineId_t(-1))
+            break;
+        MachineInfo_t victim_info = Machine_GetInfo(victim);
+        CPUPerformance_t slower = CPUPerformance_t(victim_info.p_state + 1);
+        power_floor[victim] = slower;
+        SetMachinePerformance(victim, victim_info, slower, now);
+        power_steps++;
+        for (auto vm_id : *p_vms)
+        {
+            if (vm_machine[vm_id] != victim)
+                continue;
+            for (auto task_id : VM_GetInfo(vm_id).active_tasks)
+            {
+                capped_tasks.insert(task_id);
+            }
+        }
+    }
+
+    // Lift floors while the machine's unconstrained plan fits
+    vector<MachineId_t> floored;
+    for (const auto &[machine_id, p_state] : power_floor)
+    {
+        floored.push_back(machine_id);
+    }
+    stable_sort(floored.begin(), floored.end(), [](MachineId_t a, MachineId_t b)
+                { return idle_history[a].role < idle_history[b].role; });
+    for (auto machine_id : floored)
+    {
+        MachineInfo_t info = Machine_GetInfo(machine_id);
+        const MachineClass &mclass = GetMachineClass(machine_id);
+        CPUPerformance_t faster = CPUPerformance_t(max(int(power_floor[machine_id]) - 1, int(P0)));
+        double extra = MachinePower(mclass, S0, faster, info.active_tasks) - machine_power[machine_id];
+        if (info.active_tasks > 0 && !FitsPowerCap(mclass.cpu, extra))
+            continue;
+        if (faster == P0 || info.active_tasks == 0)
+            power_floor.erase(machine_id);
+        else
+            power_floor[machine_id] = faster;
+        PlanCorePerformance(machine_id, now);
+    }
+
+    was_capped = PowerCapped();
+    if (was_capped && !pending_tasks.empty())
+    {
+        // Tasks waiting on a refused wake-up are only retried when a machine changes state, so retry them here
+        vector<TaskId_t> waiting;
+        waiting.swap(pending_tasks);
+        for (auto task_id : waiting)
+        {
+            PlaceNewTask(now, task_id);
+        }
+    }
+    // Deferred tasks go once the cap has headroom, or after POWER_CAP_MAX_DEFERRAL when it never gets any
+    vector<pair<TaskId_t, Time_t>> released;
+    for (auto it = deferred_tasks.begin(); it != deferred_tasks.end();)
+    {
+        if (!was_capped || now - it->second >= POWER_CAP_MAX_DEFERRAL)
+        {
+            released.push_back(*it);
+            it = deferred_tasks.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    for (const auto &[task_id, arrival] : released)
+    {
+        total_deferral += now - arrival;
+        PlaceNewTask(now, task_id);
+    }
+}
+// Energy price
+// ENERGY_PRICE_PATH holds (time, price) points, each price lasting until the next point; carbon intensity works the
+// same way. Best-effort arrivals wait in price_deferred while the price is above the CHEAP_PRICE_QUANTILE of the series
+// and a cheap window is still ahead, then are placed together with the dominant-fit scorer so they fill as few machines
+// as possible. SLA2 arrivals join them when SLA2_DEFERRAL_SLACK is set and leave once their slack is down to a runtime.
+static vector<pair<Time_t, double>> energy_prices;    // Sorted by time
+static double cheap_price = 0;
+static vector<pair<TaskId_t, Time_t>> price_deferred; // Tasks waiting for a cheap window, with their arrival time
+static double price_weighted_energy = 0;
+static double accounted_energy = 0;
+static Time_t last_priced = 0;
+static double total_price_time = 0;
+static unsigned price_deferrals = 0;
+static Time_t total_price_deferral = 0;
+
+static void LoadEnergyPrices()
+{
+    if (string(ENERGY_PRICE_PATH).empty())
+        return;
+    ifstream file(ENERGY_PRICE_PATH);
+    Time_t time;
+    double price;
+    while (file >> time >> price)
+    {
+        energy_prices.emplace_back(time, price);
+    }
+    if (energy_prices.empty())
+    {
+        SimOutput("LoadEnergyPrices(): No prices in " + string(ENERGY_PRICE_PATH) + ", using a flat price", 0);
+        return;
+    }
+    sort(energy_prices.begin(), energy_prices.end());
+    vector<double> prices;
+    for (const auto &[time, price] : energy_prices)
+    {
+        prices.push_back(price);
+    }
+    auto cheap = prices.begin() + size_t(CHEAP_PRICE_QUANTILE * (prices.size() - 1));
+    nth_element(prices.begin(), cheap, prices.end());
+    cheap_price = *cheap;
+    SimOutput("LoadEnergyPrices(): " + to_string(energy_prices.size()) + " prices, cheap at or below " + to_string(cheap_price), 1);
+}
+static double EnergyPrice(Time_t now)
+{
+    if (energy_prices.empty())
+        return 1;
+    auto next = upper_bound(energy_prices.begin(), energy_prices.end(), make_pair(now, HUGE_VAL));
+    return next == energy_prices.begin() ? next->second : prev(next)->second;
+}
+// True while the price is above the cheap level and the series still has a cheap window ahead
+static bool AwaitCheapWindow(Time_t now)
+{
+    if (energy_prices.empty() || EnergyPrice(now) <= cheap_price)
+        return false;
+    auto next = upper_bound(energy_prices.begin(), energy_prices.end(), make_pair(now, HUGE_VAL));
+    return any_of(next, energy_prices.end(), [](const pair<Time_t, double> &point)
+                  { return point.second <= cheap_price; });
+}
+// Start of the next cheap window after `now`, or 0 when the series has none
+static Time_t NextCheapWindow(Time_t now)
+{
+    auto next = upper_bound(energy_prices.begin(), energy_prices.end(), make_pair(now, HUGE_VAL));
+    auto cheap = find_if(next, energy_prices.end(), [](const pair<Time_t, double> &point)
+                         { return point.second <= cheap_price; });
+    return cheap == energy_prices.end() ? 0 : cheap->first;
+}
+// Slack left after running the task at P0 on the slowest machine of its CPU type, in runtimes
+static double RuntimesOfSlack(TaskId_t task_id, Time_t now)
+{
+    TaskInfo_t task_info = GetTaskInfo(task_id);
+    double mips = HUGE_VAL;
+    for (const auto &mclass : machine_classes)
+    {
+        if (mclass.cpu == task_info.required_cpu && !mclass.performance.empty())
+            mips = min(mips, double(mclass.performance[P0]));
+    }
+    double runtime = mips == HUGE_VAL ? 0 : task_info.remaining_instructions / max(mips, 1.0);
+    return runtime > 0 ? (double(task_info.target_completion) - double(now) - runtime) / runtime : 0;
+}
+static bool PriceDeferrable(TaskId_t task_id, Time_t now)
+{
+    SLAType_t sla = RequiredSLA(task_id);
+    return sla == SLA3 || (sla == SLA2 && SLA2_DEFERRAL_SLACK > 0 && RuntimesOfSlack(task_id, now) > SLA2_DEFERRAL_SLACK);
+}
+// Weighs the cluster energy spent since the last call by the price in force at its start
+static void AccountEnergyCost(Time_t now)
+{
+    double energy = Machine_GetClusterEnergy();
+    double price = EnergyPrice(last_priced);
+    price_weighted_energy += (energy - accounted_energy) * price;
+    total_price_time += price * double(now - last_priced);
+    accounted_energy = energy;
+    last_priced = now;
+}
+// Places the deferred tasks, largest first with the dominant-fit scorer, once the window is cheap. SLA2 tasks whose
+// slack has run down to one runtime go whatever the price.
+static void ReleasePriceDeferred(Time_t now)
+{
+    if (price_deferred.empty())
+        return;
+    bool cheap = !AwaitCheapWindow(now);
+    vector<pair<TaskId_t, Time_t>> released;
+    for (auto it = price_deferred.begin(); it != price_deferred.end();)
+    {
+        if (cheap || (RequiredSLA(it->first) != SLA3 && RuntimesOfSlack(it->first, now) <= 1))
+        {
+            released.push_back(*it);
+            it = price_deferred.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    stable_sort(released.begin(), released.end(), [](const pair<TaskId_t, Time_t> &a, const pair<TaskId_t, Time_t> &b)
+                { return GetTaskMemory(a.first) > GetTaskMemory(b.first); });
+    active_scorer = DOMINANT_FIT;
+    for (const auto &[task_id, arrival] : released)
+    {
+        total_price_deferral += now - arrival;
+        PlaceNewTask(now, task_id);
+    }
+    active_scorer = CURRENT_SCORER;
+    if (!released.empty())
+        SimOutput("ReleasePriceDeferred(): Placed " + to_string(released.size()) + " deferred tasks at price " + to_string(EnergyPrice(now)), 2);
+}
+static void PlanTaskMachine(TaskId_t task_id, Time_t now)
+{
+    auto it = task_vm.find(task_id);
+    if (it != task_vm.end())
+        PlanCorePerformance(vm_machine[it->second], now);
+}
+// Work stealing
+// Machines with idle cores pull work at every periodic check: first tasks still pending on a wake-up, then whole VMs
+// from machines of the same CPU type that time-slice more tasks than they have cores. The simulator keeps stale
+// state for a task moved between VMs with VM_RemoveTask/VM_AddTask, so work leaves a peer by VM migration: a VM
+// whose tasks fit the thief's idle cores moves when its last task is still estimated to finish earlier after the
+// transfer. The transfer is the larger of the migration model and the observed average, and peer stealing is off by
+// default: migrations in this simulator take tens of seconds, which no time-slicing slowdown here makes up for.
+// Nothing is stolen from completion callbacks, where the simulator cannot take new work yet.
+static unsigned tasks_stolen_from_queue = 0;
+static unsigned vms_stolen_from_peers = 0;
+
+// An existing VM of the type on the machine, warm ones first, or VMId_t(-1)
+static VMId_t CompatibleVM(MachineId_t machine_id, VMType_t vm_type, CPUType_t cpu)
+{
+    VMId_t found = VMId_t(-1);
+    for (auto vm_id : *p_vms)
+    {
+        if (vm_machine[vm_id] != machine_id || IsVMMigrating(vm_id))
+            continue;
+        VMInfo_t vm_info = VM_GetInfo(vm_id);
+        if (vm_info.vm_type != vm_type || vm_info.cpu != cpu)
+            continue;
+        if (warm_vms.count(vm_id))
+            return vm_id;
+        if (found == VMId_t(-1))
+            found = vm_id;
+    }
+    return found;
+}
+// Best scored stable machine of the CPU type with an idle core and room for the task, or MachineId_t(-1). The task
+// keeps to its own GPU pool as in NewTaskGreedy: other tasks only go to GPU machines once no non-GPU machine can wake.
+static MachineId_t IdleCoreMachine(TaskId_t task_id, CPUType_t cpu, MachineId_t excluded, Time_t now)
+{
+    bool gpu_capable = IsTaskGPUCapable(task_id);
+    for (GPUPool pool : {PoolOf(gpu_capable), PoolOf(!gpu_capable)})
+    {
+        if (pool == GPU_POOL && !gpu_capable && MachineCanBeWoken(cpu, NON_GPU_POOL))
+            break;
+        ScoreColumns(MakePlacementDemand(task_id, GetTaskMemory(task_id), cpu, pool, now));
+        for (size_t i = 0; i < placement_scores.size(); i++)
+        {
+            bool idle_core = machine_columns.active_tasks[i] < machine_columns.num_cpus[i];
+            if (placement_scores[i] == HUGE_VALF || !idle_core || MachineId_t(i) == excluded)
+            {
+                placement_scores[i] = HUGE_VALF;
+                continue;
+            }
+            // The VM scan is the expensive part, so it only runs when a new VM would not fit
+            bool room = machine_columns.memory_used[i] + GetTaskMemory(task_id) + VM_MEMORY_OVERHEAD < MAX_UTIL * machine_columns.memory_size[i] ||
+                        CompatibleVM(MachineId_t(i), RequiredVMType(task_id), cpu) != VMId_t(-1);
+            if (!room)
+                placement_scores[i] = HUGE_VALF;
+        }
+        MachineId_t best = BestScoredMachine();
+        if (best != MachineId_t(-1))
+            return best;
+    }
+    return MachineId_t(-1);
+}
+// Adds the task to a compatible VM on the machine, creating one when there is none
+static VMId_t AddTaskToMachine(MachineId_t machine_id, TaskId_t task_id, Priority_t priority)
+{
+    VMId_t vm_id = CompatibleVM(machine_id, RequiredVMType(task_id), RequiredCPUType(task_id));
+    if (vm_id == VMId_t(-1))
+        vm_id = CreateVM(RequiredVMType(task_id), RequiredCPUType(task_id), machine_id);
+    AddTaskToVM(vm_id, task_id, priority);
+    return vm_id;
+}
+static void StealWork(Time_t now)
+{
+    unsigned budget = MAX_STEALS_PER_CHECK;
+
+    // Queued tasks waiting on a machine to wake. Once no machine of a CPU type has an idle core for one of its tasks,
+    // the rest of that type's tasks with the same GPU capability are not tried again this check.
+    vector<TaskId_t> waiting(pending_tasks);
+    set<pair<CPUType_t, bool>> no_thief;
+    for (auto task_id : waiting)
+    {
+        if (budget == 0)
+            return;
+        CPUType_t cpu = RequiredCPUType(task_id);
+        pair<CPUType_t, bool> kind(cpu, IsTaskGPUCapable(task_id));
+        if (no_thief.count(kind))
+            continue;
+        MachineId_t thief = IdleCoreMachine(task_id, cpu, MachineId_t(-1), now);
+        if (thief == MachineId_t(-1))
+        {
+            no_thief.insert(kind);
+            continue;
+        }
+        pending_tasks.erase(remove(pending_tasks.begin(), pending_tasks.end(), task_id), pending_tasks.end());
+        VMId_t vm_id = AddTaskToMachine(thief, task_id, determine_priority(task_id));
+        PlanCorePerformance(thief, now);
+        tasks_stolen_from_queue++;
+        budget--;
+        SimOutput("Scheduler::StealWork(): Machine " + to_string(thief) + " pulled pending task " + to_string(task_id) + " onto VM " + to_string(vm_id), 2);
+    }
+
+    // Overloaded peers, most tasks per core first
+    if (!STEAL_FROM_PEERS)
+        return;
+    vector<pair<double, MachineId_t>> overloaded;
+    for (size_t i = 0; i < machine_summaries.size(); i++)
+    {
+        if (machine_columns.stable[i] && machine_columns.active_tasks[i] > machine_columns.num_cpus[i])
+            overloaded.emplace_back(machine_columns.active_tasks[i] / machine_columns.num_cpus[i], MachineId_t(i));
+    }
+    sort(overloaded.rbegin(), overloaded.rend());
+    for (const auto &[load, victim] : overloaded)
+    {
+        if (budget == 0)
+            return;
+        MachineInfo_t victim_info = Machine_GetInfo(victim);
+        if (victim_info.performance.empty())
+            continue;
+        double victim_share = double(victim_info.num_cpus) / victim_info.active_tasks;
+        for (auto vm_id : *p_vms)
+        {
+            if (vm_machine[vm_id] != victim || IsVMMigrating(vm_id))
+                continue;
+            VMInfo_t vm_info = VM_GetInfo(vm_id);
+            unsigned tasks = vm_info.active_tasks.size();
+            // Moving the VM must leave the victim no less busy than its cores, and an empty VM cannot move
+            if (tasks == 0 || victim_info.active_tasks - tasks < victim_info.num_cpus)
+                continue;
+            unsigned vm_memory = GetVMMemory(vm_info);
+            MachineId_t thief = MachineId_t(-1);
+            for (size_t i = 0; i < machine_summaries.size(); i++)
+            {
+                if (!machine_columns.stable[i] || machine_columns.cpu[i] != vm_info.cpu || MachineId_t(i) == victim ||
+                    machine_columns.active_tasks[i] + tasks > machine_columns.num_cpus[i] ||
+                    machine_columns.memory_used[i] + vm_memory >= MAX_UTIL * machine_columns.memory_size[i])
+                    continue;
+                if (thief == MachineId_t(-1) || machine_columns.core_mips[i] > machine_columns.core_mips[thief])
+                    thief = MachineId_t(i);
+            }
+            if (thief == MachineId_t(-1))
+                continue;
+
+            // The last of the VM's tasks to finish decides, with the transfer on top on the thief
+            Time_t stay = now;
+            Time_t move = now;
+            for (auto task_id : vm_info.active_tasks)
+            {
+                TaskInfo_t task_info = GetTaskInfo(task_id);
+                double mips = EffectiveMIPS(task_info, victim_info.performance[victim_info.p_state] * victim_share, victim_info.gpus);
+                stay = max(stay, now + Time_t(task_info.remaining_instructions / max(mips, 1.0)));
+                double energy;
+                move = max(move, EstimateCompletion(task_info, thief, now, energy));
+            }
+            move += max(EstimateMigrationTime(vm_memory, victim, thief), ObservedMigrationTime());
+            if (move >= stay)
+                continue;
+            MigrateVM(vm_id, victim, thief, vm_memory);
+            victim_info.active_tasks -= tasks;
+            vms_stolen_from_peers++;
+            budget--;
+            SimOutput("Scheduler::StealWork(): Machine " + to_string(thief) + " took VM " + to_string(vm_id) + " with " + to_string(tasks) +
+                          " tasks from machine " + to_string(victim) + ", estimated end " + to_string(move) + " instead of " + to_string(stay),
+                      2);
+            if (budget == 0 || victim_info.active_tasks <= victim_info.num_cpus)
+                break;
+        }
     }
 }
-static void Machine_TransitionState(MachineId_t machine_id, MachineState_t state)
+// Deadline core schedulers
+// The simulator serves each machine's run queue by priority and time-slices within a level. Under EARLIEST_DEADLINE
+// or LEAST_SLACK the tasks of every machine are ranked by target completion or slack: the first num_cpus run at high
+// priority, the next num_cpus at mid and the rest at low, so the most urgent tasks hold the cores. Each change can
+// preempt a running task, so a machine takes at most MAX_SWITCHES_PER_MACHINE changes per check, most urgent first.
+// ROUND_ROBIN leaves every task at the SLA priority it was placed with, the simulator's own behaviour.
+static void RankCoreQueues(Time_t now)
 {
-    Machine_SetState(machine_id, state);
-    pending_transition_count[machine_id]++;
+    map<TaskId_t, double> slack_of;
+    for (const auto &[slack, task_id] : task_slack)
+    {
+        slack_of[task_id] = slack;
+    }
+    map<MachineId_t, vector<pair<double, TaskId_t>>> queues;
+    for (const auto &[task_id, vm_id] : task_vm)
+    {
+        auto slack = slack_of.find(task_id);
+        if (slack == slack_of.end())
+            continue;
+        double key = CURRENT_CORE_SCHEDULER == EARLIEST_DEADLINE ? double(GetTaskInfo(task_id).target_completion) : slack->second;
+        queues[vm_machine[vm_id]].emplace_back(key, task_id);
+    }
+    for (auto &[machine_id, queue] : queues)
+    {
+        sort(queue.begin(), queue.end());
+        unsigned cores = max(unsigned(machine_columns.num_cpus[machine_id]), 1u);
+        unsigned switches = 0;
+        for (size_t rank = 0; rank < queue.size() && switches < MAX_SWITCHES_PER_MACHINE; rank++)
+        {
+            TaskId_t task_id = queue[rank].second;
+            Priority_t desired = rank < cores ? HIGH_PRIORITY : rank < 2 * cores ? MID_PRIORITY : LOW_PRIORITY;
+            Priority_t current = task_priority.count(task_id) ? task_priority[task_id] : determine_priority(task_id);
+            if (desired == current)
+                continue;
+            RecordDecision(DL_SET_TASK_PRIORITY, now, task_id, desired);
+            SetTaskPriority(task_id, desired);
+            task_priority[task_id] = desired;
+            priority_switches++;
+            switches++;
+            SimOutput("Scheduler::RankCoreQueues(): Task " + to_string(task_id) + " at rank " + to_string(rank) + " on machine " + to_string(machine_id) +
+                          ", priority " + to_string(current) + " -> " + to_string(desired),
+                      2);
+        }
+    }
 }
-unsigned GetProjectedMemoryUsed(MachineId_t machine_id)
+// Slack-priority engine
+// Re-ranks the running tasks by slack, the time to their target completion left over after their estimated remaining
+// runtime, and moves priorities ahead of SLAWarning: tasks running out of slack are boosted to high priority, tasks
+// that cannot make their deadline any more fall back to their SLA priority, and SLA0 tasks far ahead step down.
+static void UpdateTaskPriorities(Time_t now)
 {
-    MachineInfo_t machine_info = Machine_GetInfo(machine_id);
-    unsigned projected_memory = machine_info.memory_used;
-
-    for (const auto &migration : pending_migrations)
+    task_slack.clear();
+    map<MachineId_t, MachineInfo_t> machine_infos;
+    for (const auto &[task_id, vm_id] : task_vm)
     {
-        if (migration.target_machine == machine_id)
+        MachineId_t machine_id = vm_machine[vm_id];
+        auto info_it = machine_infos.find(machine_id);
+        if (info_it == machine_infos.end())
+            info_it = machine_infos.emplace(machine_id, Machine_GetInfo(machine_id)).first;
+        const MachineInfo_t &machine_info = info_it->second;
+        TaskInfo_t task_info = GetTaskInfo(task_id);
+        if (task_info.completed || machine_info.performance.empty())
+            continue;
+
+        double share = machine_info.active_tasks > machine_info.num_cpus ? double(machine_info.num_cpus) / machine_info.active_tasks : 1.0;
+        double mips = EffectiveMIPS(task_info, machine_info.performance[machine_info.p_state] * share, machine_info.gpus);
+        double runtime = task_info.remaining_instructions / max(mips, 1.0);
+        double slack = double(task_info.target_completion) - double(now) - runtime;
+        task_slack.emplace(slack, task_id);
+        if (CURRENT_CORE_SCHEDULER != SLA_PRIORITY)
+            continue;
+
+        // A boost can at best give the task a core of its own at P0; past that point it would only delay others
+        double best_runtime = task_info.remaining_instructions / EffectiveMIPS(task_info, machine_info.performance[P0], machine_info.gpus);
+        bool salvageable = double(task_info.target_completion) - double(now) >= best_runtime;
+
+        Priority_t base = determine_priority(task_id);
+        Priority_t current = task_priority.count(task_id) ? task_priority[task_id] : base;
+        Priority_t desired = current;
+        if (!salvageable)
+            desired = base;
+        else if (slack < SLACK_BOOST_FRACTION * runtime && task_info.required_sla != SLA3)
+            desired = HIGH_PRIORITY;
+        else if (base == HIGH_PRIORITY && slack > SLACK_DEMOTE_FRACTION * runtime)
+            desired = MID_PRIORITY;
+        // Otherwise keep the current priority. Handing a boost back as soon as slack recovers makes tasks trade places
+        // every check, so boosted tasks keep it until they finish or can no longer make it.
+        if (desired == current)
+            continue;
+
+        RecordDecision(DL_SET_TASK_PRIORITY, now, task_id, desired);
+        SetTaskPriority(task_id, desired);
+        task_priority[task_id] = desired;
+        priority_switches++;
+        if (desired < current)
         {
-            projected_memory += migration.memory_impact; // Incoming VM
+            priority_boosts++;
+            if (desired < base)
+                boosted_tasks.insert(task_id);
         }
-        else if (migration.source_machine == machine_id)
+        else
         {
-            projected_memory -= migration.memory_impact; // Outgoing VM
+            priority_demotions++;
         }
+        SimOutput("Scheduler::UpdateTaskPriorities(): Task " + to_string(task_id) + " priority " + to_string(current) + " -> " + to_string(desired) +
+                      ", slack " + to_string(Time_t(max(slack, 0.0))) + " us",
+                  2);
     }
-    return projected_memory;
+    if (CURRENT_CORE_SCHEDULER == EARLIEST_DEADLINE || CURRENT_CORE_SCHEDULER == LEAST_SLACK)
+        RankCoreQueues(now);
 }
 
 void Scheduler::Init()
@@ -148,7 +2666,39 @@ void Scheduler::Init()
     p_machines = &machines;
     pending_tasks = vector<TaskId_t>();
     pending_migrations = vector<PendingMigration>();
+    completed_migrations = 0;
+    total_migration_time = 0;
+    total_estimated_migration_time = 0;
     pending_transition_count = map<MachineId_t, int>();
+    consolidation_requested = false;
+    wakeup_queue = set<pair<Time_t, uint64_t>>();
+    wakeup_time = map<uint64_t, Time_t>();
+    wakeups_fired = 0;
+    total_wakeup_lateness = 0;
+    consolidation_plan = future<vector<ConsolidationMove>>();
+    consolidation_plans = 0;
+    consolidation_moves = 0;
+    stale_consolidation_moves = 0;
+    task_priority = map<TaskId_t, Priority_t>();
+    task_slack = multimap<double, TaskId_t>();
+    boosted_tasks = set<TaskId_t>();
+    priority_boosts = 0;
+    priority_demotions = 0;
+    sla_saves = 0;
+    priority_switches = 0;
+    demand_forecasts = map<pair<CPUType_t, VMType_t>, DemandForecast>();
+    forecast_window_start = 0;
+    check_interval = 0;
+    wake_requests = map<MachineId_t, WakeRequest>();
+    copy(begin(default_wake_latency), end(default_wake_latency), wake_latency);
+    idle_history = vector<IdleHistory>(Machine_GetTotal(), IdleHistory{false, 0, IDLE_PREDICTION_DEFAULT, SLA3});
+    requested_state = vector<MachineState_t>(Machine_GetTotal(), S0);
+    vm_machine = map<VMId_t, MachineId_t>();
+    task_vm = map<TaskId_t, VMId_t>();
+    InitMachineClasses();
+    InitClusterSummaries();
+    LoadEnergyPrices();
+    LoadPowerCaps();
 
     switch (CURRENT_ALGORITHM)
     {
@@ -187,36 +2737,31 @@ void InitPMapper()
 {
     SimOutput("Scheduler::InitPMapper(): Initializing PMapper algorithm", 1);
 
-    // Store power usage of each machine in a map
+    // Group machines by (CPU, GPU), ordered by the power consumption of their class
     unsigned total_machines = Machine_GetTotal();
-    static std::map<MachineId_t, double> machine_power_consumption;
     for (unsigned i = 0; i < total_machines; i++)
     {
-        MachineId_t machine_id = MachineId_t(i);
-        p_machines->push_back(machine_id);
-        MachineInfo_t minfo = Machine_GetInfo(machine_id);
-        double power = static_cast<double>(minfo.s_states[0]) + (minfo.num_cpus * minfo.p_states[0]);
-        machine_power_consumption[machine_id] = power;
+        p_machines->push_back(MachineId_t(i));
     }
-
-    // Identify machine classes
-    std::map<std::pair<CPUType_t, bool>, std::vector<MachineId_t>> machine_classes;
-    for (auto machine_id : *p_machines)
+    vector<double> class_power(machine_classes.size());
+    for (const auto &mclass : machine_classes)
     {
-        MachineInfo_t info = Machine_GetInfo(machine_id);
-        std::pair<CPUType_t, bool> key = {info.cpu, info.gpus};
-        machine_classes[key].push_back(machine_id);
+        // Machine_GetInfo() may not report the S-state table, only count it when present
+        double s0_power = mclass.s_states.empty() ? 0.0 : static_cast<double>(mclass.s_states[S0]);
+        class_power[mclass.class_id] = s0_power + (mclass.num_cpus * mclass.p_states[P0]);
     }
-
-    // Sort each machine class by power consumption
-    for (auto &[key, machines] : machine_classes)
+    for (const auto &mclass : machine_classes)
     {
-        sorted_classes[key] = machines;
-        std::sort(sorted_classes[key].begin(), sorted_classes[key].end(),
-                  [&](MachineId_t a, MachineId_t b)
-                  {
-                      return machine_power_consumption[a] < machine_power_consumption[b];
-                  });
+        std::pair<CPUType_t, bool> key = {mclass.cpu, mclass.gpus};
+        sorted_classes[key].insert(sorted_classes[key].end(), mclass.members.begin(), mclass.members.end());
+    }
+    for (auto &[key, machines] : sorted_classes)
+    {
+        std::stable_sort(machines.begin(), machines.end(),
+                         [&](MachineId_t a, MachineId_t b)
+                         {
+                             return class_power[GetMachineClassId(a)] < class_power[GetMachineClassId(b)];
+                         });
     }
 
     // Compute number of machines to leave on per class
@@ -242,8 +2787,8 @@ void InitPMapper()
     {
         if (machines_to_keep_active.find(machine_id) == machines_to_keep_active.end())
         {
-            MachineInfo_t info = Machine_GetInfo(machine_id);
-            std::pair<CPUType_t, bool> key = {info.cpu, info.gpus > 0};
+            const MachineClass &mclass = GetMachineClass(machine_id);
+            std::pair<CPUType_t, bool> key = {mclass.cpu, mclass.gpus};
             Machine_TransitionState(machine_id, S5);
             SimOutput("InitPMapper(): Deactivating machine " + to_string(machine_id) + " for class (CPU: " +
                           to_string(static_cast<int>(key.first)) + ", GPU: " + (key.second ? "yes" : "no") + ")",
@@ -264,6 +2809,26 @@ void InitResearch()
     // TODO
 }
 
+static void PlaceNewTask(Time_t now, TaskId_t task_id)
+{
+    switch (CURRENT_ALGORITHM)
+    {
+    case GREEDY:
+        NewTaskGreedy(now, task_id);
+        break;
+    case PMAPPER:
+        NewTaskPMapper(now, task_id);
+        break;
+    case EECO:
+        NewTaskEECO(now, task_id);
+        break;
+    case RESEARCH:
+        NewTaskResearch(now, task_id);
+        break;
+    }
+    PlanTaskMachine(task_id, now);
+}
+
 void Scheduler::NewTask(Time_t now, TaskId_t task_id)
 {
     // Get the task parameters
@@ -283,21 +2848,23 @@ void Scheduler::NewTask(Time_t now, TaskId_t task_id)
     // Turn on a machine, migrate an existing VM from a loaded machine....
     //
     // Other possibilities as desired
-    switch (CURRENT_ALGORITHM)
+    RecordArrival(task_id);
+    if (RequiredSLA(task_id) == SLA3 && PowerCapped())
     {
-    case GREEDY:
-        NewTaskGreedy(now, task_id);
-        break;
-    case PMAPPER:
-        NewTaskPMapper(now, task_id);
-        break;
-    case EECO:
-        NewTaskEECO(now, task_id);
-        break;
-    case RESEARCH:
-        NewTaskResearch(now, task_id);
-        break;
+        SimOutput("Scheduler::NewTask(): Deferring task " + to_string(task_id) + " under the power cap", 2);
+        deferred_tasks.emplace_back(task_id, now);
+        tasks_deferred++;
+        return;
+    }
+    if (AwaitCheapWindow(now) && PriceDeferrable(task_id, now))
+    {
+        SimOutput("Scheduler::NewTask(): Deferring task " + to_string(task_id) + " to a cheap window", 2);
+        price_deferred.emplace_back(task_id, now);
+        price_deferrals++;
+        Scheduler_RequestWakeup(NextCheapWindow(now), WAKE_CHEAP_WINDOW);
+        return;
     }
+    PlaceNewTask(now, task_id);
 }
 
 void NewTaskGreedy(Time_t now, TaskId_t task_id)
@@ -315,93 +2882,84 @@ void NewTaskGreedy(Time_t now, TaskId_t task_id)
     unsigned task_memory = GetTaskMemory(task_id);
     Priority_t priority = determine_priority(task_id);
 
-    // Find suitable VM
-    VMId_t suitable_vm = VMId_t(-1);
-    unsigned min_remaining_memory = UINT_MAX;
-    for (auto vm_id : *p_vms)
+    bool gpu_capable = IsTaskGPUCapable(task_id);
+
+    // GPU-capable tasks try the GPU machines first, then anything that is on. Other tasks keep off the GPU machines:
+    // they wait for a non-GPU machine to wake and only spill onto GPU machines once every non-GPU machine is on and full.
+    for (GPUPool pool : {PoolOf(gpu_capable), PoolOf(!gpu_capable)})
     {
-        VMInfo_t vm_info = VM_GetInfo(vm_id);
-        // Check if the VM is compatible with the task
-        if (vm_info.vm_type == required_vm_type &&
-            vm_info.cpu == required_cpu_type)
-        {
-            // Check if machine has space for the task
-            MachineId_t machine_id = vm_info.machine_id;
-            MachineInfo_t machine_info = Machine_GetInfo(machine_id);
-            // Check if machine is stable: S0 and no pending transitions
-            if (machine_info.s_state == S0 && pending_transition_count[machine_id] == 0)
+        // Find suitable VM. The column kernel scores every stable machine of the pool that has room for the task.
+        ScoreColumns(MakePlacementDemand(task_id, task_memory, required_cpu_type, pool, now));
+        bool vm_fit_keys = RankScoresByCompletion(task_id, now);
+        VMId_t suitable_vm = VMId_t(-1);
+        float best_score = HUGE_VALF;
+        for (auto vm_id : *p_vms)
+        {
+            MachineId_t machine_id = vm_machine[vm_id];
+            // Warm VMs win ties, so an idle VM is reused before a busy one on the same machine
+            if (placement_scores[machine_id] > best_score || (placement_scores[machine_id] == best_score && !warm_vms.count(vm_id)) ||
+                placement_scores[machine_id] == HUGE_VALF || IsVMMigrating(vm_id))
+                continue;
+            VMInfo_t vm_info = VM_GetInfo(vm_id);
+            // Check if the VM is compatible with the task
+            if (vm_info.vm_type == required_vm_type && vm_info.cpu == required_cpu_type)
             {
-                unsigned total_load = machine_info.memory_used + task_memory;
-                float u_plus_v = (float)total_load / machine_info.memory_size;
-                if (u_plus_v < MAX_UTIL)
-                {
-                    unsigned remaining = machine_info.memory_size - machine_info.memory_used;
-                    if (remaining < min_remaining_memory)
-                    {
-                        min_remaining_memory = remaining;
-                        suitable_vm = vm_id;
-                    }
-                }
+                best_score = placement_scores[machine_id];
+                suitable_vm = vm_id;
             }
         }
-    }
 
-    // If suitable VM found, add task to VM
-    if (suitable_vm != VMId_t(-1))
-    {
-        VM_AddTask(suitable_vm, task_id, priority);
-        SimOutput("Scheduler::NewTaskGreedy(): Task " + to_string(task_id) + " placed on VM " + to_string(suitable_vm), 1);
-        return;
-    }
+        // A VM on a machine that drains at a different time loses to a new VM on a busy machine that scores better
+        // with the end-time alignment, so the task does not keep its machine awake past the others. The two passes
+        // only compare when both ranked by the same key, fit scores or completion times.
+        ScoreColumns(MakePlacementDemand(task_id, VM_MEMORY_OVERHEAD + task_memory, required_cpu_type, pool, now));
+        bool machine_fit_keys = RankScoresByCompletion(task_id, now);
+        MachineId_t suitable_machine = BestScoredMachine();
+        if (suitable_vm != VMId_t(-1) && suitable_machine != MachineId_t(-1) && suitable_machine != vm_machine[suitable_vm] &&
+            END_ALIGNMENT_WEIGHT > 0 && machine_columns.drain_time[suitable_machine] != 0 && machine_fit_keys == vm_fit_keys &&
+            placement_scores[suitable_machine] < best_score)
+        {
+            SimOutput("Scheduler::NewTaskGreedy(): Task " + to_string(task_id) + " aligned with machine " + to_string(suitable_machine) +
+                          " over VM " + to_string(suitable_vm),
+                      2);
+            aligned_placements++;
+            suitable_vm = VMId_t(-1);
+        }
 
-    // No suitable VM found, now find suitable machine to create VM
-    MachineId_t suitable_machine = MachineId_t(-1);
-    min_remaining_memory = UINT_MAX;
-    for (auto machine_id : *p_machines)
-    {
-        // Check if machine can handle launching new VM and adding task
-        MachineInfo_t machine_info = Machine_GetInfo(machine_id); // Check if machine is stable: S0 and no pending transitions
-        if (machine_info.s_state == S0 && pending_transition_count[machine_id] == 0 && machine_info.cpu == required_cpu_type)
+        // If suitable VM found, add task to VM
+        if (suitable_vm != VMId_t(-1))
         {
-            unsigned total_load = machine_info.memory_used + VM_MEMORY_OVERHEAD + task_memory;
-            float u_plus_v = (float)total_load / machine_info.memory_size;
-            if (u_plus_v < MAX_UTIL)
-            {
-                unsigned remaining = machine_info.memory_size - machine_info.memory_used;
-                if (remaining < min_remaining_memory)
-                {
-                    min_remaining_memory = remaining;
-                    suitable_machine = machine_id;
-                }
-            }
+            AddTaskToVM(suitable_vm, task_id, priority);
+            SimOutput("Scheduler::NewTaskGreedy(): Task " + to_string(task_id) + " placed on VM " + to_string(suitable_vm), 1);
+            return;
         }
-    }
 
-    if (suitable_machine != MachineId_t(-1))
-    {
-        VMId_t new_vm = VM_Create(required_vm_type, required_cpu_type);
-        VM_Attach(new_vm, suitable_machine);
-        VM_AddTask(new_vm, task_id, priority);
-        p_vms->push_back(new_vm);
-        SimOutput("Scheduler::NewTaskGreedy(): Task " + to_string(task_id) + " placed on new VM " + to_string(new_vm) + " on machine " + to_string(suitable_machine), 1);
-        return;
-    }
+        // No suitable VM found, create one on the suitable machine
+        if (suitable_machine != MachineId_t(-1))
+        {
+            VMId_t new_vm = CreateVM(required_vm_type, required_cpu_type, suitable_machine);
+            AddTaskToVM(new_vm, task_id, priority);
+            SimOutput("Scheduler::NewTaskGreedy(): Task " + to_string(task_id) + " placed on new VM " + to_string(new_vm) + " on machine " + to_string(suitable_machine), 1);
+            return;
+        }
 
-    // No suitable VM or machine found; turn on new machine, change state to S0, then wait for StateChangeComplete to add task
-    for (auto machine_id : *p_machines)
-    {
-        MachineInfo_t machine_info = Machine_GetInfo(machine_id);
-        if (machine_info.cpu == required_cpu_type)
+        if (!gpu_capable && pool == NON_GPU_POOL && WakeMachineFor(required_cpu_type, NON_GPU_POOL))
         {
-            if ((machine_info.s_state == S5 && pending_transition_count[machine_id] == 0) || (machine_info.s_state == S0 && pending_transition_count[machine_id] == 1))
-            {
-                Machine_TransitionState(machine_id, S0);
-                SimOutput("Scheduler::NewTaskGreedy(): Turning on machine " + to_string(machine_id) + " for task " + to_string(task_id), 1);
-            }
             pending_tasks.push_back(task_id);
             return;
         }
     }
+
+    // No suitable VM or machine found; turn on new machine, change state to S0, then wait for StateChangeComplete to add task
+    bool cpu_available = any_of(machine_classes.begin(), machine_classes.end(), [&](const MachineClass &mclass)
+                                { return mclass.cpu == required_cpu_type; });
+    if (cpu_available)
+    {
+        if (!WakeMachineFor(required_cpu_type, PoolOf(gpu_capable)))
+            WakeMachineFor(required_cpu_type);
+        pending_tasks.push_back(task_id);
+        return;
+    }
     ThrowException("Scheduler::NewTaskGreedy(): No machine available for task " + to_string(task_id) + ", SLA violation", 1);
 }
 
@@ -432,12 +2990,22 @@ void NewTaskPMapper(Time_t now, TaskId_t task_id)
     // Lambda to attempt task placement in a given class
     auto try_place_in_class = [&](const std::pair<CPUType_t, bool> &class_key) -> bool
     {
-        std::vector<MachineId_t> &machines_in_class = sorted_classes[class_key];
-        for (auto machine_id : machines_in_class)
+        // Only consider stable machines with room for the task, best placement score first
+        std::vector<std::pair<double, MachineId_t>> candidates;
+        for (auto machine_id : sorted_classes[class_key])
         {
-            MachineInfo_t minfo = Machine_GetInfo(machine_id);
-            if (minfo.s_state != S0 && pending_transition_count[machine_id] > 0) // Only consider stable machines
+            if (!MachineMayFit(machine_id, task_memory))
                 continue;
+            double score = ScorePlacement(task_id, task_memory, Machine_GetInfo(machine_id), now);
+            if (score < HUGE_VAL)
+                candidates.emplace_back(score, machine_id);
+        }
+        std::stable_sort(candidates.begin(), candidates.end(),
+                         [](const std::pair<double, MachineId_t> &a, const std::pair<double, MachineId_t> &b)
+                         { return a.first < b.first; });
+        for (auto &[score, machine_id] : candidates)
+        {
+            MachineInfo_t minfo = Machine_GetInfo(machine_id);
 
             // Try existing VMs
             for (auto vm_id : *p_vms)
@@ -445,12 +3013,13 @@ void NewTaskPMapper(Time_t now, TaskId_t task_id)
                 VMInfo_t vminfo = VM_GetInfo(vm_id);
                 if (vminfo.machine_id == machine_id &&
                     vminfo.vm_type == required_vm_type &&
-                    vminfo.cpu == required_cpu_type)
+                    vminfo.cpu == required_cpu_type &&
+                    !IsVMMigrating(vm_id))
                 {
                     unsigned projected_memory = GetProjectedMemoryUsed(machine_id);
                     if (projected_memory + task_memory <= minfo.memory_size)
                     {
-                        VM_AddTask(vm_id, task_id, priority);
+                        AddTaskToVM(vm_id, task_id, priority);
                         SimOutput("Placed task " + to_string(task_id) + " on existing VM " +
                                       to_string(vm_id) + " on machine " + to_string(machine_id),
                                   1);
@@ -463,10 +3032,8 @@ void NewTaskPMapper(Time_t now, TaskId_t task_id)
             unsigned total_load = GetProjectedMemoryUsed(machine_id) + VM_MEMORY_OVERHEAD + task_memory;
             if (total_load <= minfo.memory_size)
             {
-                VMId_t new_vm = VM_Create(required_vm_type, required_cpu_type);
-                VM_Attach(new_vm, machine_id);
-                VM_AddTask(new_vm, task_id, priority);
-                p_vms->push_back(new_vm);
+                VMId_t new_vm = CreateVM(required_vm_type, required_cpu_type, machine_id);
+                AddTaskToVM(new_vm, task_id, priority);
                 SimOutput("Placed task " + to_string(task_id) + " on new VM " +
                               to_string(new_vm) + " on machine " + to_string(machine_id),
                           1);
@@ -476,14 +3043,6 @@ void NewTaskPMapper(Time_t now, TaskId_t task_id)
         return false;
     };
 
-    // Attempt placement in preferred class
-    if (preferred_exists && try_place_in_class(preferred_key))
-        return;
-
-    // Attempt placement in fallback class
-    if (fallback_exists && try_place_in_class(fallback_key))
-        return;
-
     // Lambda to activate a standby machine in a given class
     auto activate_machine = [&](const std::pair<CPUType_t, bool> &class_key) -> bool
     {
@@ -491,11 +3050,17 @@ void NewTaskPMapper(Time_t now, TaskId_t task_id)
             return false;
 
         std::vector<MachineId_t> &machines_in_class = sorted_classes[class_key];
+        bool type_running = CPUTypeRunning(class_key.first);
+        bool capped = false;
         for (auto machine_id : machines_in_class)
         {
-            MachineInfo_t minfo = Machine_GetInfo(machine_id);
-            if (minfo.s_state == S5) // Standby state
+            if (requested_state[machine_id] != S0 && pending_transition_count[machine_id] == 0) // Asleep
             {
+                if (!WakeFitsPowerCap(machine_id, type_running))
+                {
+                    capped = true;
+                    continue;
+                }
                 Machine_TransitionState(machine_id, S0);
                 pending_tasks.push_back(task_id);
                 SimOutput("Turning on machine " + to_string(machine_id) +
@@ -504,11 +3069,26 @@ void NewTaskPMapper(Time_t now, TaskId_t task_id)
                 return true;
             }
         }
+        if (capped)
+            RecordWakeRefused();
         return false;
     };
 
+    // Attempt placement in preferred class
+    if (preferred_exists && try_place_in_class(preferred_key))
+        return;
+
+    // GPU capacity is reserved: other tasks wait for a non-GPU machine and only spill onto GPU machines once every
+    // non-GPU machine is on and full. GPU-capable tasks run anywhere rather than wait.
+    if (!gpu_capable && preferred_exists && activate_machine(preferred_key))
+        return;
+
+    // Attempt placement in fallback class
+    if (fallback_exists && try_place_in_class(fallback_key))
+        return;
+
     // Try activating a preferred-class machine
-    if (preferred_exists && activate_machine(preferred_key))
+    if (gpu_capable && preferred_exists && activate_machine(preferred_key))
         return;
 
     // Try activating a fallback-class machine
@@ -535,6 +3115,26 @@ void Scheduler::TaskComplete(Time_t now, TaskId_t task_id)
     // Do any bookkeeping necessary for the data structures
     // Decide if a machine is to be turned off, slowed down, or VMs to be migrated according to your policy
     // This is an opportunity to make any adjustments to optimize performance/energy
+    if (boosted_tasks.erase(task_id) && GetTaskInfo(task_id).completion <= GetTaskInfo(task_id).target_completion)
+    {
+        sla_saves++;
+    }
+    if (capped_tasks.count(task_id) && GetTaskInfo(task_id).completion > GetTaskInfo(task_id).target_completion)
+    {
+        capped_sla_misses++;
+    }
+    task_priority.erase(task_id);
+    auto it = task_vm.find(task_id);
+    if (it != task_vm.end())
+    {
+        MachineId_t machine_id = vm_machine[it->second];
+        NoteVMIdle(it->second, task_id, now);
+        task_vm.erase(it);
+        ForgetTaskEnd(task_id, machine_id);
+        UpdateMachineSummary(machine_id);
+        PlanCorePerformance(machine_id, now);
+    }
+
     switch (CURRENT_ALGORITHM)
     {
     case GREEDY:
@@ -545,229 +3145,28 @@ void Scheduler::TaskComplete(Time_t now, TaskId_t task_id)
         break;
     case EECO:
         TaskCompleteEECO(now, task_id);
-        break;
-    case RESEARCH:
-        TaskCompleteResearch(now, task_id);
-        break;
-    }
-}
-
-void TaskCompleteGreedy(Time_t now, TaskId_t task_id)
-{
-    SimOutput("Scheduler::TaskCompleteGreedy(): Task " + to_string(task_id) + " completed at time " + to_string(now), 1);
-
-    // Sort machines by projected utilization
-    vector<pair<MachineId_t, float>> machine_utils;
-    for (auto machine_id : *p_machines)
-    {
-        MachineInfo_t machine_info = Machine_GetInfo(machine_id);
-        if (machine_info.s_state == S0)
-        {
-            unsigned projected_memory = GetProjectedMemoryUsed(machine_id);
-            float u = (float)projected_memory / machine_info.memory_size;
-            machine_utils.emplace_back(machine_id, u);
-        }
-    }
-    sort(machine_utils.begin(), machine_utils.end(), [](const pair<MachineId_t, float> &a, const pair<MachineId_t, float> &b)
-         { return a.second < b.second; });
-
-    // Consolidate by migrating VMs from low-utilization machines
-    for (size_t j = 0; j < machine_utils.size(); j++)
-    {
-        MachineId_t machine_id = machine_utils[j].first;
-        float u = machine_utils[j].second;
-        if (u == 0.0f)
-            continue; // Skip empty machines
-
-        // Skip machines with pending incoming migrations
-        bool has_incoming = false;
-        for (const auto &migration : pending_migrations)
-        {
-            if (migration.target_machine == machine_id)
-            {
-                has_incoming = true;
-                break;
-            }
-        }
-        if (has_incoming)
-            continue;
-
-        // Collect VMs not currently migrating
-        vector<VMId_t> vms_to_migrate;
-        for (auto vm_id : *p_vms)
-        {
-            VMInfo_t vm_info = VM_GetInfo(vm_id);
-            if (vm_info.machine_id == machine_id)
-            {
-                bool is_migrating = false;
-                for (const auto &migration : pending_migrations)
-                {
-                    if (migration.vm_id == vm_id)
-                    {
-                        is_migrating = true;
-                        break;
-                    }
-                }
-                if (!is_migrating)
-                {
-                    vms_to_migrate.push_back(vm_id);
-                }
-            }
-        }
-
-        for (auto vm_id : vms_to_migrate)
-        {
-            VMInfo_t vm_info = VM_GetInfo(vm_id);
-            CPUType_t cpu_type = vm_info.cpu;
-            unsigned vm_memory = 0;
-            for (auto tid : vm_info.active_tasks)
-            {
-                vm_memory += GetTaskMemory(tid);
-            }
-            vm_memory += VM_MEMORY_OVERHEAD;
-
-            // Find a target machine with higher utilization
-            for (size_t k = j + 1; k < machine_utils.size(); k++)
-            {
-                MachineId_t target_machine = machine_utils[k].first;
-                MachineInfo_t target_info = Machine_GetInfo(target_machine);
-                unsigned projected_memory = GetProjectedMemoryUsed(target_machine);
-                unsigned total_load = projected_memory + vm_memory;
-                float target_u_plus_v = (float)total_load / target_info.memory_size;
-                if (target_info.s_state == S0 && target_info.cpu == cpu_type && target_u_plus_v < MAX_UTIL)
-                {
-                    // Initiate migration and track it
-                    VM_Migrate(vm_id, target_machine);
-                    pending_migrations.push_back({vm_id, machine_id, target_machine, vm_memory});
-                    SimOutput("Scheduler::TaskCompleteGreedy(): Migrating VM " + to_string(vm_id) +
-                                  " from machine " + to_string(machine_id) + " to " + to_string(target_machine),
-                              1);
-                    break; // Move to next VM
-                }
-            }
-        }
-
-        // Check if machine is now empty (considering pending migrations)
-        unsigned projected_memory = GetProjectedMemoryUsed(machine_id);
-        if (projected_memory == 0 && machine_id >= MIN_ACTIVE_MACHINES_GREEDY)
-        {
-            Machine_TransitionState(machine_id, S5);
-            SimOutput("Scheduler::TaskCompleteGreedy(): Turning off machine " + to_string(machine_id), 1);
-        }
-    }
-}
-
-void TaskCompletePMapper(Time_t now, TaskId_t task_id)
-{
-    // Log the task completion event
-    SimOutput("TaskCompletePMapper: Task " + to_string(task_id) + " completed at " + to_string(now), 1);
-
-    // Step 1: Identify active machines
-    std::vector<MachineId_t> active_machines;
-    for (auto machine_id : *p_machines)
-    {
-        MachineInfo_t minfo = Machine_GetInfo(machine_id);
-        if (minfo.s_state == S0 && pending_transition_count[machine_id] == 0) // Stable machine
-        {
-            active_machines.push_back(machine_id);
-        }
-    }
-    if (active_machines.empty())
-        return; // No active machines to process
-
-    // Step 2: Calculate utilization for each active machine
-    std::vector<std::pair<MachineId_t, float>> machine_utils;
-    for (auto machine_id : active_machines)
-    {
-        MachineInfo_t minfo = Machine_GetInfo(machine_id);
-        unsigned projected_memory = GetProjectedMemoryUsed(machine_id);
-        float u = (float)projected_memory / minfo.memory_size; // Utilization as a fraction
-        machine_utils.emplace_back(machine_id, u);
-    }
-
-    // Step 3: Sort machines by utilization in ascending order
-    std::sort(machine_utils.begin(), machine_utils.end(),
-              [](const std::pair<MachineId_t, float> &a, const std::pair<MachineId_t, float> &b)
-              {
-                  return a.second < b.second;
-              });
-
-    // Step 4: Split into lower and upper halves
-    size_t split = machine_utils.size() / 2;
-    std::vector<MachineId_t> lower_half, upper_half;
-    for (size_t i = 0; i < machine_utils.size(); i++)
-    {
-        if (i < split)
-            lower_half.push_back(machine_utils[i].first); // Underutilized machines
-        else
-            upper_half.push_back(machine_utils[i].first); // Highly utilized machines
+        break;
+    case RESEARCH:
+        TaskCompleteResearch(now, task_id);
+        break;
     }
+}
 
-    // Step 5: Migrate VMs from lower half to upper half
-    for (auto source_machine : lower_half)
-    {
-        // Get VMs on the source machine
-        std::vector<VMId_t> vms_on_machine;
-        for (auto vm_id : *p_vms)
-        {
-            VMInfo_t vminfo = VM_GetInfo(vm_id);
-            if (vminfo.machine_id == source_machine)
-            {
-                vms_on_machine.push_back(vm_id);
-            }
-        }
+void TaskCompleteGreedy(Time_t now, TaskId_t task_id)
+{
+    SimOutput("Scheduler::TaskCompleteGreedy(): Task " + to_string(task_id) + " completed at time " + to_string(now), 1);
 
-        for (auto vm_id : vms_on_machine)
-        {
-            VMInfo_t vminfo = VM_GetInfo(vm_id);
-            CPUType_t cpu_type = vminfo.cpu;
-            unsigned vm_memory = VM_MEMORY_OVERHEAD; // Base memory overhead for the VM
-            for (auto tid : vminfo.active_tasks)
-            {
-                vm_memory += GetTaskMemory(tid); // Add memory for each active task
-            }
+    // Consolidate at the next periodic check, once for all completions since the last one
+    consolidation_requested = true;
+}
 
-            // Try to migrate to a machine in the upper half with the same CPU type
-            for (auto target_machine : upper_half)
-            {
-                MachineInfo_t target_info = Machine_GetInfo(target_machine);
-                if (target_info.cpu == cpu_type) // Ensure CPU compatibility
-                {
-                    unsigned projected_memory = GetProjectedMemoryUsed(target_machine);
-                    if (projected_memory + vm_memory <= target_info.memory_size) // Check memory capacity
-                    {
-                        // Check if the VM is not already migrating
-                        bool is_migrating = false;
-                        for (auto &migration : pending_migrations)
-                        {
-                            if (migration.vm_id == vm_id)
-                            {
-                                is_migrating = true;
-                                break;
-                            }
-                        }
-                        if (!is_migrating)
-                        {
-                            // Perform the migration
-                            VM_Migrate(vm_id, target_machine);
-                            pending_migrations.push_back({vm_id, source_machine, target_machine, vm_memory});
-                            SimOutput("Migrating VM " + to_string(vm_id) + " from " +
-                                          to_string(source_machine) + " to " + to_string(target_machine),
-                                      1);
-                            break; // Move to the next VM
-                        }
-                    }
-                }
-            }
-        }
+void TaskCompletePMapper(Time_t now, TaskId_t task_id)
+{
+    // Log the task completion event
+    SimOutput("TaskCompletePMapper: Task " + to_string(task_id) + " completed at " + to_string(now), 1);
 
-        // Step 6: Turn off the source machine if it becomes empty
-        if (GetProjectedMemoryUsed(source_machine) == 0)
-        {
-            Machine_TransitionState(source_machine, S5); // S5 indicates an off state
-            SimOutput("Turning off machine " + to_string(source_machine), 1);
-        }
-    }
+    // Consolidate at the next periodic check, once for all completions since the last one
+    consolidation_requested = true;
 }
 
 void TaskCompleteEECO(Time_t now, TaskId_t task_id)
@@ -785,6 +3184,22 @@ void TaskCompleteResearch(Time_t now, TaskId_t task_id)
 void Scheduler::MigrationComplete(Time_t time, VMId_t vm_id)
 {
     // Update your data structure. The VM now can receive new tasks
+    vector<MachineId_t> affected_machines;
+    for (const auto &migration : pending_migrations)
+    {
+        if (migration.vm_id == vm_id)
+        {
+            affected_machines.push_back(migration.source_machine);
+            affected_machines.push_back(migration.target_machine);
+            completed_migrations++;
+            total_migration_time += time - migration.start;
+            total_estimated_migration_time += migration.estimated_completion - migration.start;
+            SimOutput("Scheduler::MigrationComplete(): VM " + to_string(vm_id) + " took " + to_string(time - migration.start) +
+                          " us, estimated " + to_string(migration.estimated_completion - migration.start) + " us",
+                      2);
+        }
+    }
+
     switch (CURRENT_ALGORITHM)
     {
     case GREEDY:
@@ -800,6 +3215,12 @@ void Scheduler::MigrationComplete(Time_t time, VMId_t vm_id)
         MigrationCompleteResearch(time, vm_id);
         break;
     }
+
+    for (auto machine_id : affected_machines)
+    {
+        UpdateMachineSummary(machine_id);
+        PlanCorePerformance(machine_id, time);
+    }
 }
 
 void MigrationCompleteGreedy(Time_t time, VMId_t vm_id)
@@ -852,12 +3273,32 @@ void MigrationCompleteResearch(Time_t time, VMId_t vm_id)
     // TODO
 }
 
+void Scheduler::NewTaskBatch(Time_t now, const vector<TaskId_t> &task_ids)
+{
+    // Largest first packs the batch tighter; among equal sizes the earliest deadline picks first. Each task is then
+    // placed on its own, against the columns as the tasks before it left them.
+    vector<TaskId_t> order(task_ids);
+    stable_sort(order.begin(), order.end(), [](TaskId_t a, TaskId_t b)
+                {
+                    unsigned memory_a = GetTaskMemory(a), memory_b = GetTaskMemory(b);
+                    if (memory_a != memory_b)
+                        return memory_a > memory_b;
+                    return GetTaskInfo(a).target_completion < GetTaskInfo(b).target_completion; });
+    SimOutput("Scheduler::NewTaskBatch(): Placing " + to_string(order.size()) + " tasks at time " + to_string(now), 2);
+    for (auto task_id : order)
+    {
+        NewTask(now, task_id);
+    }
+}
+
 void Scheduler::PeriodicCheck(Time_t now)
 {
     // This method should be called from SchedulerCheck()
     // SchedulerCheck is called periodically by the simulator to allow you to monitor, make decisions, adjustments, etc.
     // Unlike the other invocations of the scheduler, this one doesn't report any specific event
     // Recommendation: Take advantage of this function to do some monitoring and adjustments as necessary
+    UpdateDemandForecasts(now);
+    ExpireWarmVMs(now);
     switch (CURRENT_ALGORITHM)
     {
     case GREEDY:
@@ -873,23 +3314,46 @@ void Scheduler::PeriodicCheck(Time_t now)
         PeriodicCheckResearch(now);
         break;
     }
+    StealWork(now);
+
+    // Deadlines draw closer between events, re-plan every machine running tasks
+    set<MachineId_t> busy_machines;
+    for (const auto &[task_id, vm_id] : task_vm)
+    {
+        busy_machines.insert(vm_machine[vm_id]);
+    }
+    for (auto machine_id : busy_machines)
+    {
+        PlanCorePerformance(machine_id, now);
+    }
+    EnforcePowerCap(now);
+    ReleasePriceDeferred(now);
+    UpdateTaskPriorities(now);
 }
 
 void PeriodicCheckGreedy(Time_t now)
 {
     SimOutput("Scheduler::PeriodicCheckGreedy(): SchedulerCheck() called at " + to_string(now), 3);
 
-    for (auto machine_id : *p_machines)
+    PlanEvacuations(now);
+    PlanConsolidation(now);
+
+    map<CPUType_t, double> parked;
+    // Shutting VMs down and parking machines updates idle_machines, so walk a copy
+    vector<MachineId_t> idle(idle_machines.begin(), idle_machines.end());
+    SimOutput("Scheduler::PeriodicCheck(): Visiting " + to_string(idle.size()) + " idle machines, " + to_string(machine_deltas) + " machine deltas so far", 3);
+    for (auto machine_id : idle)
     {
         MachineInfo_t machine_info = Machine_GetInfo(machine_id);
-        if (machine_info.s_state == S0 && pending_transition_count[machine_id] == 0 && machine_info.active_vms == 0)
+        if (machine_info.s_state == S0 && pending_transition_count[machine_id] == 0 && machine_info.active_tasks == 0)
         {
+            if (machine_id < MIN_ACTIVE_MACHINES_GREEDY)
+                continue; // Stays on, so its empty VMs are left to the warm pool
             bool shutdown = true;
 
             for (auto it = p_vms->begin(); it != p_vms->end();)
             {
-                VMInfo_t vm_info = VM_GetInfo(*it);
-                if (vm_info.machine_id == machine_id && vm_info.active_tasks.empty())
+                if (vm_machine[*it] == machine_id && VM_GetInfo(*it).active_tasks.empty())
                 {
                     // Check if VM is migrating
                     for (auto &migration : pending_migrations)
@@ -907,7 +3371,7 @@ void PeriodicCheckGreedy(Time_t now)
                     }
 
                     SimOutput("Scheduler::PeriodicCheckGreedy(): Shutting down VM " + to_string(*it), 1);
-                    VM_Shutdown(*it);
+                    ShutdownVM(*it);
                     it = p_vms->erase(it);
                 }
                 else
@@ -917,49 +3381,56 @@ void PeriodicCheckGreedy(Time_t now)
             }
 
             machine_info = Machine_GetInfo(machine_id); // Refresh info
-            assert(machine_info.active_vms == 0);
             if (machine_info.active_vms == 0 && machine_id >= MIN_ACTIVE_MACHINES_GREEDY)
             {
-                SimOutput("Scheduler::PeriodicCheckGreedy(): Turning off machine " + to_string(machine_id), 1);
-                Machine_TransitionState(machine_id, S5);
+                MarkIdle(machine_id, now);
+                MachineState_t sleep_state = ChooseSleepState(machine_id, now);
+                if (sleep_state != S0 && !NeededForForecast(machine_id, parked))
+                {
+                    SimOutput("Scheduler::PeriodicCheckGreedy(): Putting machine " + to_string(machine_id) + " into S-state " + to_string(sleep_state), 1);
+                    Machine_TransitionState(machine_id, sleep_state);
+                }
             }
         }
     }
+    DeepenSleepStates(now);
+    PreWakeMachines(now);
 }
 
 void PeriodicCheckPMapper(Time_t now)
 {
     SimOutput("Scheduler::PeriodicCheckPMapper(): SchedulerCheck() called at " + to_string(now), 3);
 
+    PlanEvacuations(now);
+    PlanConsolidation(now);
+
     // Step 1: Track active machine counts per class
     std::map<std::pair<CPUType_t, bool>, unsigned> active_machine_counts;
-    for (const auto &[class_key, machines] : sorted_classes)
+    for (const auto &mclass : machine_classes)
     {
-        unsigned count = 0;
-        for (auto machine_id : sorted_classes[class_key])
-        {
-            MachineInfo_t minfo = Machine_GetInfo(machine_id);
-            if (minfo.s_state == S0)
-            {
-                count++;
-            }
-        }
-        active_machine_counts[class_key] = count;
+        active_machine_counts[{mclass.cpu, mclass.gpus}] += class_summaries[mclass.class_id].active_machines;
     }
 
-    // Step 2: Iterate through all machines
-    for (auto machine_id : *p_machines)
+    // Step 2: Iterate through the idle machines
+    map<CPUType_t, double> parked;
+    // Shutting VMs down and parking machines updates idle_machines, so walk a copy
+    vector<MachineId_t> idle(idle_machines.begin(), idle_machines.end());
+    SimOutput("Scheduler::PeriodicCheck(): Visiting " + to_string(idle.size()) + " idle machines, " + to_string(machine_deltas) + " machine deltas so far", 3);
+    for (auto machine_id : idle)
     {
         MachineInfo_t machine_info = Machine_GetInfo(machine_id);
-        if (machine_info.s_state == S0 && pending_transition_count[machine_id] == 0 && machine_info.active_vms == 0)
+        if (machine_info.s_state == S0 && pending_transition_count[machine_id] == 0 && machine_info.active_tasks == 0)
         {
+            const MachineClass &mclass = GetMachineClass(machine_id);
+            std::pair<CPUType_t, bool> class_key = {mclass.cpu, mclass.gpus};
+            if (active_machine_counts[class_key] <= MIN_ACTIVE_MACHINES_PER_CLASS_PMAPPER)
+                continue; // Stays on, so its empty VMs are left to the warm pool
             bool shutdown = true;
 
             // Step 3: Check and shut down VMs on the machine
             for (auto it = p_vms->begin(); it != p_vms->end();)
             {
-                VMInfo_t vm_info = VM_GetInfo(*it);
-                if (vm_info.machine_id == machine_id && vm_info.active_tasks.empty())
+                if (vm_machine[*it] == machine_id && VM_GetInfo(*it).active_tasks.empty())
                 {
                     // Check if VM is migrating
                     for (auto &migration : pending_migrations)
@@ -977,7 +3448,7 @@ void PeriodicCheckPMapper(Time_t now)
                     }
 
                     SimOutput("Scheduler::PeriodicCheckPMapper(): Shutting down VM " + to_string(*it), 1);
-                    VM_Shutdown(*it);
+                    ShutdownVM(*it);
                     it = p_vms->erase(it);
                 }
                 else
@@ -988,24 +3459,29 @@ void PeriodicCheckPMapper(Time_t now)
 
             // Step 4: Check if machine can be turned off
             machine_info = Machine_GetInfo(machine_id); // Refresh info
-            assert(machine_info.active_vms == 0);
             if (machine_info.active_vms == 0)
             {
-                MachineInfo_t minfo = Machine_GetInfo(machine_id);
-                std::pair<CPUType_t, bool> class_key = {minfo.cpu, minfo.gpus};
+                MachineState_t sleep_state = S0;
                 if (active_machine_counts[class_key] > MIN_ACTIVE_MACHINES_PER_CLASS_PMAPPER)
                 {
-                    SimOutput("Scheduler::PeriodicCheckPMapper(): Turning off machine " + to_string(machine_id), 1);
-                    Machine_TransitionState(machine_id, S5);
+                    MarkIdle(machine_id, now);
+                    sleep_state = ChooseSleepState(machine_id, now);
+                }
+                if (sleep_state != S0 && !NeededForForecast(machine_id, parked))
+                {
+                    SimOutput("Scheduler::PeriodicCheckPMapper(): Putting machine " + to_string(machine_id) + " into S-state " + to_string(sleep_state), 1);
+                    Machine_TransitionState(machine_id, sleep_state);
                     active_machine_counts[class_key]--; // Update active count
                 }
                 else
                 {
-                    SimOutput("Scheduler::PeriodicCheckPMapper(): Machine " + to_string(machine_id) + " is required to meet minimum active machines per class", 1);
+                    SimOutput("Scheduler::PeriodicCheckPMapper(): Machine " + to_string(machine_id) + " is required to meet minimum active machines or forecast demand", 1);
                 }
             }
         }
     }
+    DeepenSleepStates(now);
+    PreWakeMachines(now);
 }
 
 void PeriodicCheckEECO(Time_t now)
@@ -1028,12 +3504,43 @@ void Scheduler::Shutdown(Time_t time)
     // Shutdown everything to be tidy :-)
     for (auto &vm : vms)
     {
+        RecordDecision(DL_VM_SHUTDOWN, time, vm);
         VM_Shutdown(vm);
     }
     SimOutput("SimulationComplete(): Finished!", 1);
     SimOutput("SimulationComplete(): Time is " + to_string(time), 1);
 }
 
+// Asks for the next periodic check to run on the simulator's own period
+static void RequestFastCadence()
+{
+    check_backoff = 1;
+    next_check_due = 0;
+}
+// True when the periodic work can wait for a later check: no task runs, nothing changed since the last one that ran,
+// no task or machine is waiting on the scheduler, and the stretched cadence is not due yet. With SCHEDULER_CHECK_PERIOD set the
+// work also waits for its period while busy, and policies that need to act sooner request a wakeup.
+static bool SkipPeriodicCheck(Time_t now)
+{
+    if (last_simulator_check != 0)
+        simulator_check_period = now - last_simulator_check;
+    last_simulator_check = now;
+
+    bool quiet = task_vm.empty() && machine_deltas == deltas_at_last_check && pending_tasks.empty() && arrival_buffer.empty() &&
+                 pending_migrations.empty() && wake_requests.empty() && deferred_tasks.empty() && power_floor.empty() &&
+                 price_deferred.empty();
+    if ((quiet || SCHEDULER_CHECK_PERIOD > 0) && now < next_check_due)
+    {
+        checks_skipped++;
+        return true;
+    }
+    check_backoff = quiet ? min(check_backoff * 2, unsigned(CHECK_BACKOFF_MAX)) : 1;
+    next_check_due = now + check_backoff * max(simulator_check_period, Time_t(SCHEDULER_CHECK_PERIOD));
+    deltas_at_last_check = machine_deltas;
+    checks_run++;
+    return false;
+}
+
 // ------------------------
 // Public interface below
 // ------------------------
@@ -1041,21 +3548,56 @@ static Scheduler scheduler;
 
 void InitScheduler()
 {
+    if (DecisionCallback(DL_INIT, Now()))
+        return;
     scheduler.Init();
 }
 
+// Places the buffered arrivals once the batching window has closed, or right away when `force` is set
+static void FlushArrivals(Time_t time, bool force)
+{
+    if (arrival_buffer.empty() || (!force && time - arrival_buffer.front().second < ARRIVAL_BATCH_QUANTUM))
+        return;
+    vector<TaskId_t> batch;
+    for (const auto &[task_id, arrival] : arrival_buffer)
+    {
+        batch.push_back(task_id);
+        total_batching_delay += time - arrival;
+        max_batching_delay = max(max_batching_delay, time - arrival);
+    }
+    arrival_buffer.clear();
+    batched_tasks += batch.size();
+    batches_placed++;
+    scheduler.NewTaskBatch(time, batch);
+}
+
 void HandleNewTask(Time_t time, TaskId_t task_id)
 {
-    scheduler.NewTask(time, task_id);
+    if (DecisionCallback(DL_NEW_TASK, time, task_id))
+        return;
+    ServiceWakeups(time);
+    if (ARRIVAL_BATCH_QUANTUM == 0)
+    {
+        scheduler.NewTask(time, task_id);
+        return;
+    }
+    FlushArrivals(time, false);
+    arrival_buffer.emplace_back(task_id, time);
 }
 
 void HandleTaskCompletion(Time_t time, TaskId_t task_id)
 {
+    if (DecisionCallback(DL_TASK_COMPLETE, time, task_id))
+        return;
     scheduler.TaskComplete(time, task_id);
 }
 
 void MemoryWarning(Time_t time, MachineId_t machine_id)
 {
+    if (DecisionCallback(DL_MEMORY_WARNING, time, machine_id))
+        return;
+    ServiceWakeups(time);
+    RequestFastCadence();
     switch (CURRENT_ALGORITHM)
     {
     case GREEDY:
@@ -1076,15 +3618,17 @@ void MemoryWarning(Time_t time, MachineId_t machine_id)
 void MemoryWarningGreedy(Time_t time, MachineId_t machine_id)
 {
     // Assume memory warning on machine
-    // Pick workload with highest utilization, and apply SLAWarningGreedy()
+    // Evacuate whole VMs by plan; only if no target fits, pick workload with highest utilization, and apply SLAWarningGreedy()
     SimOutput("MemoryWarning(): Memory warning on machine " + to_string(machine_id) + " at time " + to_string(time), 1);
+    if (EvacuateOvercommitted(machine_id, time))
+        return;
 
     // Sort VMs by utilization
     vector<pair<VMId_t, float>> vm_utils;
     for (auto vm_id : *p_vms)
     {
         VMInfo_t vm_info = VM_GetInfo(vm_id);
-        if (vm_info.machine_id == machine_id)
+        if (vm_info.machine_id == machine_id && !IsVMMigrating(vm_id))
         {
             unsigned total_load = 0;
             for (auto tid : vm_info.active_tasks)
@@ -1116,13 +3660,15 @@ void MemoryWarningGreedy(Time_t time, MachineId_t machine_id)
 void MemoryWarningPMapper(Time_t time, MachineId_t machine_id)
 {
     SimOutput("MemoryWarningPMapper: Memory warning on machine " + to_string(machine_id) + " at " + to_string(time), 1);
+    if (EvacuateOvercommitted(machine_id, time))
+        return;
 
     // Step 1: Identify VMs on the overcommitted machine
     std::vector<VMId_t> vms_on_machine;
     for (auto vm_id : *p_vms)
     {
         VMInfo_t vminfo = VM_GetInfo(vm_id);
-        if (vminfo.machine_id == machine_id)
+        if (vminfo.machine_id == machine_id && !IsVMMigrating(vm_id))
         {
             vms_on_machine.push_back(vm_id);
         }
@@ -1171,31 +3717,134 @@ void MemoryWarningResearch(Time_t time, MachineId_t machine_id)
 void MigrationDone(Time_t time, VMId_t vm_id)
 {
     // The function is called on to alert you that migration is complete
+    if (DecisionCallback(DL_MIGRATION_DONE, time, vm_id))
+        return;
+    ServiceWakeups(time);
     scheduler.MigrationComplete(time, vm_id);
 }
 
 void SchedulerCheck(Time_t time)
 {
     // This function is called periodically by the simulator, no specific event
+    if (DecisionCallback(DL_PERIODIC_CHECK, time))
+        return;
+    ServiceWakeups(time);
+    FlushArrivals(time, false);
+    AccountEnergyCost(time);
+    if (SkipPeriodicCheck(time))
+        return;
     scheduler.PeriodicCheck(time);
 }
 
+void SchedulerWakeup(Time_t time, uint64_t cookie)
+{
+    SimOutput("SchedulerWakeup(): Cookie " + to_string(cookie) + " at " + to_string(time), 3);
+    switch (cookie)
+    {
+    case WAKE_CHEAP_WINDOW:
+        ReleasePriceDeferred(time);
+        break;
+    default:
+        SimOutput("SchedulerWakeup(): No handler for cookie " + to_string(cookie), 1);
+        break;
+    }
+}
+
 void SimulationComplete(Time_t time)
 {
     // This function is called before the simulation terminates. TODO: Add whatever you feel like.
+    bool replayed = DecisionCallback(DL_SIMULATION_COMPLETE, time);
+    FlushArrivals(time, true);
+    AccountEnergyCost(time);
     cout << "SLA violation report" << endl;
     cout << "SLA0: " << GetSLAReport(SLA0) << "%" << endl;
     cout << "SLA1: " << GetSLAReport(SLA1) << "%" << endl;
     cout << "SLA2: " << GetSLAReport(SLA2) << "%" << endl; // SLA3 do not have SLA violation issues
     cout << "Total Energy " << Machine_GetClusterEnergy() << "KW-Hour" << endl;
+    machine_seconds += double(machines_on) * double(time - machines_on_since) / 1000000;
+    machines_on_since = time;
+    cout << "Machine-hours " << machine_seconds / 3600;
+    if (aligned_placements > 0)
+        cout << ", " << aligned_placements << " tasks placed for end-time alignment";
+    cout << endl;
+    if (completed_migrations > 0)
+    {
+        cout << "Migrations: " << completed_migrations << ", average " << total_migration_time / completed_migrations
+             << " us (estimated " << total_estimated_migration_time / completed_migrations << " us), "
+             << GetMigrationsInFlight().size() << " still in flight" << endl;
+    }
+    if (priority_boosts + priority_demotions > 0)
+    {
+        cout << "Priority boosts: " << priority_boosts << ", demotions: " << priority_demotions << ", SLA saves: " << sla_saves << endl;
+    }
+    if (consolidation_plans > 0)
+    {
+        cout << "Consolidation: " << consolidation_plans << " plans, " << consolidation_moves << " moves applied, "
+             << stale_consolidation_moves << " stale moves dropped" << endl;
+    }
+    cout << "Core scheduler: " << priority_switches << " priority switches" << endl;
+    if (CLUSTER_POWER_CAP > 0 || cpu_capped)
+    {
+        cout << "Power cap: " << double(capped_time) / 1000000 << " s capped, " << power_steps << " P-state steps, " << wakes_refused
+             << " wake-ups refused, " << tasks_deferred << " SLA3 tasks deferred"
+             << (tasks_deferred > 0 ? " (average " + to_string(total_deferral / tasks_deferred) + " us)" : "") << ", "
+             << capped_sla_misses << " of " << capped_tasks.size() << " capped tasks missed their SLA" << endl;
+    }
+    if (!energy_prices.empty())
+    {
+        cout << "Energy cost " << price_weighted_energy << " price x KW-Hour, average price " << total_price_time / max(double(time), 1.0)
+             << ", " << price_deferrals << " tasks deferred to cheap windows"
+             << (price_deferrals > 0 ? " (average " + to_string(total_price_deferral / price_deferrals) + " us)" : "") << endl;
+    }
+    if (checks_skipped > 0)
+    {
+        cout << "Periodic checks: " << checks_run << " run, " << checks_skipped << " skipped" << (SCHEDULER_CHECK_PERIOD > 0 ? "" : " while idle") << endl;
+    }
+    if (wakeups_fired > 0)
+    {
+        cout << "Wakeups: " << wakeups_fired << " fired, average lateness " << total_wakeup_lateness / wakeups_fired << " us, "
+             << wakeup_queue.size() << " still pending" << endl;
+    }
+    if (batches_placed > 0)
+    {
+        cout << "Arrival batches: " << batches_placed << ", " << double(batched_tasks) / batches_placed << " tasks each, batching delay average "
+             << total_batching_delay / batched_tasks << " us, max " << max_batching_delay << " us" << endl;
+    }
+    if (tasks_stolen_from_queue + vms_stolen_from_peers > 0)
+    {
+        cout << "Work stealing: " << tasks_stolen_from_queue << " pending tasks and " << vms_stolen_from_peers << " VMs from overloaded machines moved to idle cores" << endl;
+    }
+    if (estimates_cached + estimates_computed > 0)
+    {
+        cout << "Completion estimates: " << estimates_computed << " computed, " << estimates_cached << " from the cache" << endl;
+    }
+    if (warm_hits + warm_misses > 0)
+    {
+        cout << "Warm VMs: " << warm_hits << " hits, " << warm_misses << " misses, " << warm_expired << " expired" << endl;
+    }
+    if (PLACEMENT_BENCHMARK_ROUNDS > 0)
+    {
+        BenchmarkPlacementKernels();
+    }
     cout << "Simulation run finished in " << double(time) / 1000000 << " seconds" << endl;
     SimOutput("SimulationComplete(): Simulation finished at time " + to_string(time), 1);
 
-    scheduler.Shutdown(time);
+    if (!replayed)
+        scheduler.Shutdown(time);
+    if (decision_log != nullptr)
+    {
+        FlushDecisionLog();
+        fclose(decision_log);
+        decision_log = nullptr;
+    }
 }
 
 void SLAWarning(Time_t time, TaskId_t task_id)
 {
+    if (DecisionCallback(DL_SLA_WARNING, time, task_id))
+        return;
+    ServiceWakeups(time);
+    RequestFastCadence();
     switch (CURRENT_ALGORITHM)
     {
     case GREEDY:
@@ -1211,6 +3860,7 @@ void SLAWarning(Time_t time, TaskId_t task_id)
         SLAWarningResearch(time, task_id);
         break;
     }
+    PlanTaskMachine(task_id, time);
 }
 
 void SLAWarningGreedy(Time_t time, TaskId_t task_id)
@@ -1238,22 +3888,23 @@ void SLAWarningGreedy(Time_t time, TaskId_t task_id)
     unsigned task_memory = GetTaskMemory(task_id);
     CPUType_t cpu_type = vm_info.cpu;
 
-    // Sort machines by utilization
-    vector<pair<MachineId_t, float>> machine_utils;
-    for (auto machine_id : *p_machines)
-    {
-        MachineInfo_t machine_info = Machine_GetInfo(machine_id);
-        if (machine_info.s_state == S0 && machine_id != current_machine)
-        {
-            float u = (float)machine_info.memory_used / machine_info.memory_size;
-            machine_utils.emplace_back(machine_id, u);
-        }
-    }
-    sort(machine_utils.begin(), machine_utils.end(), [](const pair<MachineId_t, float> &a, const pair<MachineId_t, float> &b)
-         { return a.second < b.second; });
+    // Rank candidate machines by estimated completion
+    vector<pair<double, MachineId_t>> machine_scores;
+    ForEachFittingMachine(cpu_type, task_memory + VM_MEMORY_OVERHEAD,
+                          [&](MachineId_t machine_id)
+                          {
+                              if (machine_id != current_machine)
+                              {
+                                  double score = ScorePlacement(task_id, task_memory + VM_MEMORY_OVERHEAD, Machine_GetInfo(machine_id), time);
+                                  if (score < HUGE_VAL)
+                                      machine_scores.emplace_back(score, machine_id);
+                              }
+                              return false;
+                          });
+    RankByCompletion(task_id, machine_scores, time);
 
     // Try migrating to another machine
-    for (auto &[machine_id, u] : machine_utils)
+    for (auto &[score, machine_id] : machine_scores)
     {
         MachineInfo_t machine_info = Machine_GetInfo(machine_id);
         unsigned total_load = machine_info.memory_used + task_memory + VM_MEMORY_OVERHEAD;
@@ -1264,40 +3915,36 @@ void SLAWarningGreedy(Time_t time, TaskId_t task_id)
             for (auto vm_id : *p_vms)
             {
                 VMInfo_t vm_info = VM_GetInfo(vm_id);
-                if (vm_info.machine_id == machine_id && vm_info.cpu == cpu_type)
+                if (vm_info.machine_id == machine_id && vm_info.cpu == cpu_type && !IsVMMigrating(vm_id))
                 {
-                    VM_AddTask(vm_id, task_id, determine_priority(task_id));
-                    VM_RemoveTask(current_vm, task_id);
+                    AddTaskToVM(vm_id, task_id, determine_priority(task_id));
+                    RemoveTaskFromVM(current_vm, task_id);
                     SimOutput("SLAWarning(): Migrated task " + to_string(task_id) + " to existing VM " + to_string(vm_id) + " on machine " + to_string(machine_id), 1);
                     return;
                 }
             }
             // If not, create a new VM
-            VMId_t new_vm = VM_Create(vm_info.vm_type, cpu_type);
-            VM_Attach(new_vm, machine_id);
-            VM_AddTask(new_vm, task_id, determine_priority(task_id));
-            VM_RemoveTask(current_vm, task_id);
-            p_vms->push_back(new_vm);
+            VMId_t new_vm = CreateVM(vm_info.vm_type, cpu_type, machine_id);
+            AddTaskToVM(new_vm, task_id, determine_priority(task_id));
+            RemoveTaskFromVM(current_vm, task_id);
             SimOutput("SLAWarning(): Migrated task " + to_string(task_id) + " to new VM " + to_string(new_vm) + " on machine " + to_string(machine_id), 1);
             return;
         }
     }
 
     // Try turning on a standby machine
-    for (auto machine_id : *p_machines)
+    if (WakeMachineFor(cpu_type))
     {
-        MachineInfo_t machine_info = Machine_GetInfo(machine_id);
-        if (machine_info.cpu == cpu_type)
-        {
-            if (machine_info.s_state == S5 && pending_transition_count[machine_id] == 0)
-            {
-                Machine_TransitionState(machine_id, S0);
-            }
-            pending_tasks.push_back(task_id);
-            VM_RemoveTask(current_vm, task_id);
-            SimOutput("SLAWarning(): Turning on machine " + to_string(machine_id) + " for task " + to_string(task_id), 1);
-            return;
-        }
+        pending_tasks.push_back(task_id);
+        RemoveTaskFromVM(current_vm, task_id);
+        SimOutput("SLAWarning(): Waiting for a machine to turn on for task " + to_string(task_id), 1);
+        return;
+    }
+    if (any_of(machine_classes.begin(), machine_classes.end(), [&](const MachineClass &mclass)
+               { return mclass.cpu == cpu_type; }))
+    {
+        SimOutput("SLAWarning(): Every machine for task " + to_string(task_id) + " is on, leaving it in place", 1);
+        return;
     }
 
     ThrowException("SLAWarning(): Failed to resolve SLA violation for task " + to_string(task_id), 0);
@@ -1329,62 +3976,65 @@ void SLAWarningPMapper(Time_t time, TaskId_t task_id)
     unsigned task_memory = GetTaskMemory(task_id);
     Priority_t priority = determine_priority(task_id);
 
-    // Step 3: Find a suitable machine to migrate the task
-    for (auto machine_id : *p_machines)
+    // Step 3: Find a suitable machine to migrate the task, best placement score first
+    vector<pair<double, MachineId_t>> candidates;
+    ForEachFittingMachine(required_cpu_type, task_memory,
+                          [&](MachineId_t machine_id)
+                          {
+                              if (machine_id != current_machine)
+                              {
+                                  double score = ScorePlacement(task_id, task_memory, Machine_GetInfo(machine_id), time);
+                                  if (score < HUGE_VAL)
+                                      candidates.emplace_back(score, machine_id);
+                              }
+                              return false;
+                          });
+    RankByCompletion(task_id, candidates, time);
+    for (auto &[score, machine_id] : candidates)
     {
-        if (machine_id == current_machine)
-            continue;
-
         MachineInfo_t minfo = Machine_GetInfo(machine_id);
-        if (minfo.s_state == S0 && pending_transition_count[machine_id] == 0 && minfo.cpu == required_cpu_type)
+        // Check existing VMs on this machine
+        for (auto vm_id : *p_vms)
         {
-            // Check existing VMs on this machine
-            for (auto vm_id : *p_vms)
+            VMInfo_t vminfo = VM_GetInfo(vm_id);
+            if (vminfo.machine_id == machine_id && vminfo.vm_type == required_vm_type && !IsVMMigrating(vm_id))
             {
-                VMInfo_t vminfo = VM_GetInfo(vm_id);
-                if (vminfo.machine_id == machine_id && vminfo.vm_type == required_vm_type)
+                unsigned projected_memory = GetProjectedMemoryUsed(machine_id);
+                if (projected_memory + task_memory <= minfo.memory_size)
                 {
-                    unsigned projected_memory = GetProjectedMemoryUsed(machine_id);
-                    if (projected_memory + task_memory <= minfo.memory_size)
-                    {
-                        VM_AddTask(vm_id, task_id, priority);
-                        VM_RemoveTask(current_vm, task_id);
-                        SimOutput("Migrated task " + to_string(task_id) + " to VM " + to_string(vm_id) + " on machine " + to_string(machine_id), 1);
-                        return;
-                    }
+                    AddTaskToVM(vm_id, task_id, priority);
+                    RemoveTaskFromVM(current_vm, task_id);
+                    SimOutput("Migrated task " + to_string(task_id) + " to VM " + to_string(vm_id) + " on machine " + to_string(machine_id), 1);
+                    return;
                 }
             }
+        }
 
-            // Create a new VM if no suitable VM exists
-            unsigned total_load = GetProjectedMemoryUsed(machine_id) + VM_MEMORY_OVERHEAD + task_memory;
-            if (total_load <= minfo.memory_size)
-            {
-                VMId_t new_vm = VM_Create(required_vm_type, required_cpu_type);
-                VM_Attach(new_vm, machine_id);
-                VM_AddTask(new_vm, task_id, priority);
-                VM_RemoveTask(current_vm, task_id);
-                p_vms->push_back(new_vm);
-                SimOutput("Created new VM " + to_string(new_vm) + " on machine " + to_string(machine_id) + " for task " + to_string(task_id), 1);
-                return;
-            }
+        // Create a new VM if no suitable VM exists
+        unsigned total_load = GetProjectedMemoryUsed(machine_id) + VM_MEMORY_OVERHEAD + task_memory;
+        if (total_load <= minfo.memory_size)
+        {
+            VMId_t new_vm = CreateVM(required_vm_type, required_cpu_type, machine_id);
+            AddTaskToVM(new_vm, task_id, priority);
+            RemoveTaskFromVM(current_vm, task_id);
+            SimOutput("Created new VM " + to_string(new_vm) + " on machine " + to_string(machine_id) + " for task " + to_string(task_id), 1);
+            return;
         }
     }
 
     // Step 4: If no machine is available, activate a standby machine
-    for (auto machine_id : *p_machines)
+    if (WakeMachineFor(required_cpu_type))
     {
-        MachineInfo_t minfo = Machine_GetInfo(machine_id);
-        if (minfo.cpu == required_cpu_type)
-        {
-            if (minfo.s_state == S5 && pending_transition_count[machine_id] == 0)
-            {
-                Machine_TransitionState(machine_id, S0);
-            }
-            pending_tasks.push_back(task_id);
-            VM_RemoveTask(current_vm, task_id);
-            SimOutput("Turning on machine " + to_string(machine_id) + " for task " + to_string(task_id), 1);
-            return;
-        }
+        pending_tasks.push_back(task_id);
+        RemoveTaskFromVM(current_vm, task_id);
+        SimOutput("Waiting for a machine to turn on for task " + to_string(task_id), 1);
+        return;
+    }
+    if (any_of(machine_classes.begin(), machine_classes.end(), [&](const MachineClass &mclass)
+               { return mclass.cpu == required_cpu_type; }))
+    {
+        SimOutput("Every machine for task " + to_string(task_id) + " is on, leaving it in place", 1);
+        return;
     }
 
     ThrowException("Failed to resolve SLA violation for task " + to_string(task_id), 0);
@@ -1400,6 +4050,10 @@ void SLAWarningResearch(Time_t time, TaskId_t task_id)
 
 void StateChangeComplete(Time_t time, MachineId_t machine_id)
 {
+    if (DecisionCallback(DL_STATE_CHANGE_COMPLETE, time, machine_id))
+        return;
+    ServiceWakeups(time);
+    RecordStateChange(time, machine_id);
     switch (CURRENT_ALGORITHM)
     {
     case GREEDY:
@@ -1415,6 +4069,58 @@ void StateChangeComplete(Time_t time, MachineId_t machine_id)
         StateChangeCompleteResearch(time, machine_id);
         break;
     }
+    UpdateMachineSummary(machine_id);
+}
+
+// Places a task waiting on a wake-up with NewTaskGreedy's scoring: the best scored existing VM of the task's type,
+// else a new VM on the best scored machine, GPU-capable tasks on GPU machines first. Other tasks only go to GPU
+// machines once no non-GPU machine of their CPU type can wake. False when no stable machine has room.
+static bool PlacePendingTask(TaskId_t task_id, Time_t now)
+{
+    VMType_t required_vm_type = RequiredVMType(task_id);
+    CPUType_t required_cpu_type = RequiredCPUType(task_id);
+    unsigned task_memory = GetTaskMemory(task_id);
+    bool gpu_capable = IsTaskGPUCapable(task_id);
+    for (GPUPool pool : {PoolOf(gpu_capable), PoolOf(!gpu_capable)})
+    {
+        if (pool == GPU_POOL && !gpu_capable && MachineCanBeWoken(required_cpu_type, NON_GPU_POOL))
+            break;
+        ScoreColumns(MakePlacementDemand(task_id, task_memory, required_cpu_type, pool, now));
+        RankScoresByCompletion(task_id, now);
+        VMId_t suitable_vm = VMId_t(-1);
+        float best_score = HUGE_VALF;
+        for (auto vm_id : *p_vms)
+        {
+            MachineId_t machine_id = vm_machine[vm_id];
+            if (placement_scores[machine_id] > best_score || (placement_scores[machine_id] == best_score && !warm_vms.count(vm_id)) ||
+                placement_scores[machine_id] == HUGE_VALF || IsVMMigrating(vm_id))
+                continue;
+            VMInfo_t vm_info = VM_GetInfo(vm_id);
+            if (vm_info.vm_type == required_vm_type && vm_info.cpu == required_cpu_type)
+            {
+                best_score = placement_scores[machine_id];
+                suitable_vm = vm_id;
+            }
+        }
+        if (suitable_vm != VMId_t(-1))
+        {
+            AddTaskToVM(suitable_vm, task_id, determine_priority(task_id));
+            SimOutput("StateChangeComplete(): Placed task " + to_string(task_id) + " on VM " + to_string(suitable_vm), 1);
+            return true;
+        }
+
+        ScoreColumns(MakePlacementDemand(task_id, VM_MEMORY_OVERHEAD + task_memory, required_cpu_type, pool, now));
+        RankScoresByCompletion(task_id, now);
+        MachineId_t suitable_machine = BestScoredMachine();
+        if (suitable_machine != MachineId_t(-1))
+        {
+            VMId_t new_vm = CreateVM(required_vm_type, required_cpu_type, suitable_machine);
+            AddTaskToVM(new_vm, task_id, determine_priority(task_id));
+            SimOutput("StateChangeComplete(): Placed task " + to_string(task_id) + " on new VM " + to_string(new_vm) + " on machine " + to_string(suitable_machine), 1);
+            return true;
+        }
+    }
+    return false;
 }
 
 void StateChangeCompleteGreedy(Time_t time, MachineId_t machine_id)
@@ -1431,60 +4137,13 @@ void StateChangeCompleteGreedy(Time_t time, MachineId_t machine_id)
     // Place tasks only if machine is stable (S0 and no pending transitions)
     if (machine_info.s_state == S0 && pending_transition_count[machine_id] == 0)
     {
-        // Place all pending tasks on a machine WITH matching properties
+        // The columns must see the machine as stable before scoring
+        UpdateMachineSummary(machine_id);
         vector<TaskId_t> placed_tasks;
         for (auto tid : pending_tasks)
         {
-            VMType_t required_vm_type = RequiredVMType(tid);
-            CPUType_t required_cpu_type = RequiredCPUType(tid);
-            unsigned task_memory = GetTaskMemory(tid);
-            Priority_t priority = determine_priority(tid);
-
-            // Look for a suitable VM to place the task on ANY machine
-            VMId_t best_vm = VMId_t(-1);
-            unsigned min_remaining_memory = UINT_MAX;
-            for (auto vm_id : *p_vms)
-            {
-                VMInfo_t vm_info = VM_GetInfo(vm_id);
-                if (vm_info.vm_type == required_vm_type && vm_info.cpu == required_cpu_type)
-                {
-                    MachineInfo_t minfo = Machine_GetInfo(vm_info.machine_id);
-                    unsigned total_load = minfo.memory_used + task_memory;
-                    float u_plus_v = (float)total_load / minfo.memory_size;
-                    if (minfo.s_state == S0 && u_plus_v < MAX_UTIL)
-                    {
-                        unsigned remaining = minfo.memory_size - minfo.memory_used;
-                        if (remaining < min_remaining_memory)
-                        {
-                            min_remaining_memory = remaining;
-                            best_vm = vm_id;
-                        }
-                    }
-                }
-            }
-
-            // If a suitable VM is found, place the task on it
-            if (best_vm != VMId_t(-1))
-            {
-                VM_AddTask(best_vm, tid, priority);
-                placed_tasks.push_back(tid);
-                SimOutput("StateChangeComplete(): Placed task " + to_string(tid) + " on VM " + to_string(best_vm), 1);
-                continue;
-            }
-
-            // If no suitable VM is found, create a new VM on the stable machine
-            MachineInfo_t minfo = Machine_GetInfo(machine_id);
-            unsigned total_load = minfo.memory_used + VM_MEMORY_OVERHEAD + task_memory;
-            float u_plus_v = (float)total_load / minfo.memory_size;
-            if (minfo.cpu == required_cpu_type && u_plus_v < MAX_UTIL)
-            {
-                VMId_t new_vm = VM_Create(required_vm_type, required_cpu_type);
-                VM_Attach(new_vm, machine_id);
-                VM_AddTask(new_vm, tid, priority);
-                p_vms->push_back(new_vm);
+            if (PlacePendingTask(tid, time))
                 placed_tasks.push_back(tid);
-                SimOutput("StateChangeComplete(): Placed task " + to_string(tid) + " on new VM " + to_string(new_vm) + " on machine " + to_string(machine_id), 1);
-            }
         }
 
         for (auto tid : placed_tasks)
@@ -1492,6 +4151,7 @@ void StateChangeCompleteGreedy(Time_t time, MachineId_t machine_id)
             pending_tasks.erase(remove(pending_tasks.begin(), pending_tasks.end(), tid), pending_tasks.end());
         }
     }
+    WakeForPendingTasks();
 }
 
 void StateChangeCompletePMapper(Time_t time, MachineId_t machine_id)
@@ -1506,83 +4166,12 @@ void StateChangeCompletePMapper(Time_t time, MachineId_t machine_id)
 
     if (minfo.s_state == S0 && pending_transition_count[machine_id] == 0)
     {
+        UpdateMachineSummary(machine_id);
         std::vector<TaskId_t> placed_tasks;
         for (auto tid : pending_tasks)
         {
-            VMType_t required_vm_type = RequiredVMType(tid);
-            CPUType_t required_cpu_type = RequiredCPUType(tid);
-            unsigned task_memory = GetTaskMemory(tid);
-            Priority_t priority = determine_priority(tid);
-
-            // Try to place on existing VMs across all machines
-            VMId_t best_vm = VMId_t(-1);
-            unsigned min_remaining_memory = UINT_MAX;
-            for (auto vm_id : *p_vms)
-            {
-                VMInfo_t vminfo = VM_GetInfo(vm_id);
-                if (vminfo.vm_type == required_vm_type && vminfo.cpu == required_cpu_type)
-                {
-                    MachineInfo_t minfo = Machine_GetInfo(vminfo.machine_id);
-                    if (minfo.s_state == S0)
-                    {
-                        unsigned projected_memory = GetProjectedMemoryUsed(vminfo.machine_id);
-                        if (projected_memory + task_memory <= minfo.memory_size)
-                        {
-                            unsigned remaining = minfo.memory_size - projected_memory;
-                            if (remaining < min_remaining_memory)
-                            {
-                                min_remaining_memory = remaining;
-                                best_vm = vm_id;
-                            }
-                        }
-                    }
-                }
-            }
-
-            if (best_vm != VMId_t(-1))
-            {
-                VM_AddTask(best_vm, tid, priority);
+            if (PlacePendingTask(tid, time))
                 placed_tasks.push_back(tid);
-                SimOutput("Placed pending task " + to_string(tid) + " on VM " + to_string(best_vm), 1);
-                continue;
-            }
-
-            // Try the newly active machine
-            MachineInfo_t minfo = Machine_GetInfo(machine_id);
-            if (minfo.cpu == required_cpu_type)
-            {
-                unsigned total_load = GetProjectedMemoryUsed(machine_id) + VM_MEMORY_OVERHEAD + task_memory;
-                if (total_load <= minfo.memory_size)
-                {
-                    VMId_t new_vm = VM_Create(required_vm_type, required_cpu_type);
-                    VM_Attach(new_vm, machine_id);
-                    VM_AddTask(new_vm, tid, priority);
-                    p_vms->push_back(new_vm);
-                    placed_tasks.push_back(tid);
-                    SimOutput("Placed pending task " + to_string(tid) + " on new VM " + to_string(new_vm) + " on machine " + to_string(machine_id), 1);
-                    continue;
-                }
-            }
-
-            // Try another active machine
-            for (auto m_id : *p_machines)
-            {
-                MachineInfo_t m_info = Machine_GetInfo(m_id);
-                if (m_info.s_state == S0 && m_info.cpu == required_cpu_type)
-                {
-                    unsigned total_load = GetProjectedMemoryUsed(m_id) + VM_MEMORY_OVERHEAD + task_memory;
-                    if (total_load <= m_info.memory_size)
-                    {
-                        VMId_t new_vm = VM_Create(required_vm_type, required_cpu_type);
-                        VM_Attach(new_vm, m_id);
-                        VM_AddTask(new_vm, tid, priority);
-                        p_vms->push_back(new_vm);
-                        placed_tasks.push_back(tid);
-                        SimOutput("Placed pending task " + to_string(tid) + " on new VM " + to_string(new_vm) + " on machine " + to_string(m_id), 1);
-                        break;
-                    }
-                }
-            }
         }
 
         for (auto tid : placed_tasks)
@@ -1590,6 +4179,7 @@ void StateChangeCompletePMapper(Time_t time, MachineId_t machine_id)
             pending_tasks.erase(std::remove(pending_tasks.begin(), pending_tasks.end(), tid), pending_tasks.end());
         }
     }
+    WakeForPendingTasks();
 }
 
 void StateChangeCompleteEECO(Time_t time, MachineId_t machine_id)
@@ -18,6 +18,7 @@ public:
     void Init();
     void MigrationComplete(Time_t time, VMId_t vm_id);
     void NewTask(Time_t now, TaskId_t task_id);
+    void NewTaskBatch(Time_t now, const vector<TaskId_t> & task_ids);
     void PeriodicCheck(Time_t now);
     void Shutdown(Time_t now);
     void TaskComplete(Time_t now, TaskId_t task_id);